@@ -0,0 +1,257 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef AFFECT_H_
+#define AFFECT_H_
+
+#include <math.h>
+#include "psys.h"
+
+/* affectors: everything an update does to a particle, besides aging and
+ * moving it. Each one is set up once per update, and then applied to one
+ * particle at a time by an inline apply, which returns false to kill it.
+ * AffectPipeline chains the affectors of a feature set into a single call,
+ * so the update visits every particle once, no matter how many act on it.
+ *
+ * Affectors work in the units the particles are stored in, so that compact
+ * particles don't have to be converted: their constants are scaled by the
+ * storage units at set up (which are 1 for full particles).
+ */
+
+struct AffectUnits {
+	float pos;		// storage units per unit
+	float vel;		// storage units per unit/sec
+};
+
+// the part of a particle affectors see
+struct AffectState {
+	Vec3 pos, vel;
+	float t;			// age, as a fraction of the lifetime
+	Vec3 color;			// set by the ramps
+	float alpha, scale;
+};
+
+// kill particles outside of an area of the x/y plane
+struct AffCull {
+	Vec3 cmin, cmax;
+	unsigned long count;	// killed so far
+
+	void setup(const Vec3 &vmin, const Vec3 &vmax, const AffectUnits &u)
+	{
+		cmin = vmin * u.pos;
+		cmax = vmax * u.pos;
+		count = 0;
+	}
+
+	inline bool apply(AffectState *s)
+	{
+		if(s->pos.x < cmin.x || s->pos.x > cmax.x || s->pos.y < cmin.y || s->pos.y > cmax.y) {
+			count++;
+			return false;
+		}
+		return true;
+	}
+};
+
+struct AffGravity {
+	Vec3 step;
+
+	void setup(const PSysParam &pp, const AffectUnits &u, float dt)
+	{
+		step = pp.gravity * (dt * u.vel);
+	}
+
+	inline bool apply(AffectState *s) const
+	{
+		s->vel = s->vel + step;
+		return true;
+	}
+};
+
+// acceleration from the curl noise field at the particle's position
+struct AffTurb {
+	const NoiseVolume *turb;
+	float scale, accel;
+
+	void setup(const PSysParam &pp, const AffectUnits &u, float dt)
+	{
+		turb = pp.turb;
+		scale = pp.turb_freq / u.pos;
+		accel = pp.turb_strength * dt * u.vel;
+	}
+
+	inline bool apply(AffectState *s) const
+	{
+		s->vel += turb->lookup(s->pos * scale) * accel;
+		return true;
+	}
+};
+
+// velocity decays by pp.drag per second, exponentially
+struct AffDrag {
+	float keep;
+
+	void setup(const PSysParam &pp, float dt)
+	{
+		keep = exp(-pp.drag * dt);
+	}
+
+	inline bool apply(AffectState *s) const
+	{
+		s->vel = s->vel * keep;
+		return true;
+	}
+};
+
+/* push particles away from the pointer and drag them along with it, less
+ * so further away, up to its radius
+ */
+struct AffPointer {
+	Vec3 pos, vel;
+	float radius, rad_sq;
+	float repel, stir, dt;
+	float vel_scale;	// velocity units per position unit
+	double min_dist;	// below which there's no direction to push in
+
+	void setup(const PSysPointer &ptr, const AffectUnits &u, float dt)
+	{
+		pos = ptr.pos * u.pos;
+		vel = ptr.vel * u.vel;
+		radius = ptr.radius * u.pos;
+		rad_sq = radius * radius;
+		repel = ptr.repel;
+		stir = ptr.stir;
+		this->dt = dt;
+		vel_scale = u.vel / u.pos;
+		min_dist = 1e-6 * u.pos;
+	}
+
+	inline bool apply(AffectState *s) const
+	{
+		float dx = s->pos.x - pos.x;
+		float dy = s->pos.y - pos.y;
+		float dsq = dx * dx + dy * dy;
+		if(dsq >= rad_sq) return true;
+
+		float dist = sqrt(dsq);
+		float w = 1.0 - dist / radius;
+		if(dist > min_dist) {
+			float f = repel * w * dt / dist * vel_scale;
+			s->vel.x += dx * f;
+			s->vel.y += dy * f;
+		}
+
+		float f = stir * w * dt;
+		if(f > 1.0) f = 1.0;
+		s->vel += (vel - s->vel) * f;
+		return true;
+	}
+};
+
+// color and alpha gradient over the lifetime
+struct AffColorRamp {
+	const PSysParam *pp;
+
+	void setup(const PSysParam &pp)
+	{
+		this->pp = &pp;
+	}
+
+	inline bool apply(AffectState *s) const
+	{
+		if(s->t < 0.5) {
+			float t = s->t * 2.0;
+			s->color = lerp(pp->pcolor_start, pp->pcolor_mid, t);
+			s->alpha = lerp(pp->palpha_start, pp->palpha_mid, t);
+		} else {
+			float t = (s->t - 0.5) * 2.0;
+			s->color = lerp(pp->pcolor_mid, pp->pcolor_end, t);
+			s->alpha = lerp(pp->palpha_mid, pp->palpha_end, t);
+		}
+		return true;
+	}
+};
+
+// size curve over the lifetime
+struct AffSizeCurve {
+	const PSysParam *pp;
+
+	void setup(const PSysParam &pp)
+	{
+		this->pp = &pp;
+	}
+
+	inline bool apply(AffectState *s) const
+	{
+		if(s->t < 0.5) {
+			float t = s->t * 2.0;
+			s->scale = lerp(pp->pscale_start, pp->pscale_mid, t);
+		} else {
+			float t = (s->t - 0.5) * 2.0;
+			s->scale = lerp(pp->pscale_mid, pp->pscale_end, t);
+		}
+		return true;
+	}
+};
+
+/* the affectors of the features in FEAT, in the order they're applied: the
+ * kill conditions first, then the forces, and the ramps for storage which
+ * keeps their results (RAMPS). Affectors which need the other particles
+ * (density) can't be part of it, they take a pass of their own.
+ */
+template <unsigned int FEAT, bool RAMPS>
+struct AffectPipeline {
+	AffCull cull;
+	AffGravity gravity;
+	AffTurb turb;
+	AffDrag drag;
+	AffPointer pointer;
+	AffColorRamp color;
+	AffSizeCurve size;
+
+	void setup(const PSysParam &pp, const Vec3 &cmin, const Vec3 &cmax, const PSysPointer &ptr,
+			const AffectUnits &u, float dt)
+	{
+		cull.setup(cmin, cmax, u);
+		if(FEAT & PSYS_GRAVITY) gravity.setup(pp, u, dt);
+		if(FEAT & PSYS_TURB) turb.setup(pp, u, dt);
+		if(FEAT & PSYS_DRAG) drag.setup(pp, dt);
+		if(FEAT & PSYS_POINTER) pointer.setup(ptr, u, dt);
+		if(RAMPS) {
+			color.setup(pp);
+			size.setup(pp);
+		}
+	}
+
+	inline bool apply(AffectState *s)
+	{
+		// the view bounds are infinite without one, so it's not a feature of its own
+		if(!cull.apply(s)) return false;
+
+		if(FEAT & PSYS_GRAVITY) gravity.apply(s);
+		if(FEAT & PSYS_TURB) turb.apply(s);
+		if(FEAT & PSYS_DRAG) drag.apply(s);
+		if(FEAT & PSYS_POINTER) pointer.apply(s);
+		if(RAMPS) {
+			color.apply(s);
+			size.apply(s);
+		}
+		return true;
+	}
+};
+
+#endif	// AFFECT_H_
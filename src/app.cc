@@ -18,13 +18,31 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <stddef.h>
 #include <time.h>
-#include <GL/gl.h>
+#include <errno.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include <sys/stat.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <atomic>
 #include <drawtext.h>
 #include "app.h"
+#include "opengl.h"
 #include "psys.h"
+#include "imgenc.h"
+#include "tribuf.h"
+#include "tpool.h"
+#include "outline.h"
+#include "noise.h"
+#include "trace.h"
+#include "ckpt.h"
+#include "flipbook.h"
+#include "trails.h"
 
 #include "pimg.h"
 
@@ -35,44 +53,328 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define PREFIX "/usr/local"
 #endif
 
+#define STATS_INTERVAL	5000
+
+Options opt;
+
+/* the turbulence field is rebuilt in the background every so often, evolving
+ * by TURB_EVOLVE_RATE noise features' worth of change per second
+ */
+#define TURB_REBUILD_INTERVAL	250
+#define TURB_EVOLVE_RATE		0.5
+#define TURB_SEED				0x7ab1e5
+
+// clock placement, in app_draw and for mapping the pointer back
+#define VIEW_SCALE		0.9
+#define VIEW_OFFSET_Y	-0.1
+
+// pointer interaction, in the space of the clock particles
+#define POINTER_RADIUS	0.15
+#define POINTER_REPEL	6.0
+#define POINTER_STIR	10.0
+
+#define EXPLODE_FORCE	1.0
+#define EXPLODE_DUR		1.0
+// bursts of changing digits: a quick puff, which retires their flames
+#define BURST_FORCE		0.35
+#define BURST_DUR		0.3
+
+#define SPAWN_MAP_WIDTH		256
+#define SPAWN_MAP_HEIGHT	128
+
+/* flipbook mode: the glyphs clocks show, the string the spawn rate is meant
+ * for, seconds of simulation before the loop, and how long the flames of a
+ * changed character take to cross-fade into the new one
+ */
+#define FLIP_GLYPHS			"0123456789:."
+#define FLIP_REF_STRING		"00:00.00"
+#define FLIP_WARMUP			1.0
+#define FLIP_CHANGE_DUR		0.25
+
+// spawn map for an upcoming time string, built on the thread pool
+struct SpawnMapJob {
+	char timestr[64];
+	std::vector<unsigned char> pixels;
+	std::vector<float> cell_end;
+	unsigned int seed;
+	std::atomic<SpawnMap*> map;		// null until done
+
+	~SpawnMapJob() { delete map.load(); }
+};
+
+/* UTC offset of a time zone over a stretch of time, with at most one
+ * transition in it, so that it can be applied without touching TZ
+ */
+struct ZoneOffsets {
+	time_t start, end;			// covered: [start, end)
+	time_t change;				// the transition, or end if there's none
+	long offset, next_offset;	// seconds east of UTC, before and after it
+};
+
+struct Clock {
+	const char *tz;		// null for local time
+	ZoneOffsets zone;	// guarded by zone_lock
+	ParticleSystem psys;
+	Image *spawn_map;
+	char timestr[64];
+
+	std::shared_ptr<SpawnMapJob> next_map;
+
+	// flipbook mode: the previous string, and the pen position of each character
+	char prev_timestr[64];
+	std::vector<float> pens, prev_pens;
+	double change_time;
+};
+
 static PSysParam ppflame;
 
-static ParticleSystem psys;
-static Image *pimg, *time_image;
+/* clocks of all simulations, back to back. With split outputs, each output
+ * has its own set of clocks_per_sim clocks, otherwise they all show the first.
+ */
+static Clock *clocks[MAX_OUTPUTS * MAX_ZONES];
+static ParticleSystem *clock_psys[MAX_OUTPUTS * MAX_ZONES];
+static int num_clocks, clocks_per_sim, num_sims;
+
+/* pipelined mode: the simulation thread produces frame N+1 while the main
+ * thread draws frame N from a snapshot. Only the main thread talks to X/GL.
+ */
+struct Snapshot {
+	std::vector<PSysVertex> verts[MAX_OUTPUTS];	// one array per simulation
+	double time;								// sim_time of the frame
+};
+
+static TripleBuffer<Snapshot> snapshots;
+static Snapshot *cur_snap;
+static std::thread sim_thread;
+static std::mutex sim_lock;
+static std::condition_variable sim_cond;
+static unsigned long sim_frames_requested;
+static long long sim_present;	// of the requested frame
+static bool sim_quit;
+static char *orig_tz;
+
+/* clocks are formatted on the update thread, but TZ is only ever switched on
+ * the main thread, ZONE_SPAN seconds ahead, once less than ZONE_REFRESH
+ * seconds are left
+ */
+#define ZONE_SPAN		(2 * 86400)
+#define ZONE_REFRESH	86400
+static std::mutex zone_lock;
+
+static Image *pimg;
+
+static Trails *trails[MAX_OUTPUTS];	// of each output, with -trails
+static double trail_time[MAX_OUTPUTS];	// of the last frame drawn with trails
+
+/* simulated seconds, the sum of the frame time steps. Unlike the wall clock,
+ * it's the same when a trace is replayed or recorded.
+ */
+static double sim_time;
+
+static FlipBook *flipbooks[256];	// flipbook mode: of each glyph
+static double flip_time;
 
 static dtx_font *font;
+static FontOutline outlines;
+static bool use_outlines;
+static bool preloading;
+static TraceHeader trace_hdr;
+
+#define MAX_STARTUP_EVENTS	16
+
+struct StartupEvent {
+	const char *name;
+	double t;
+};
+static StartupEvent startup_events[MAX_STARTUP_EVENTS];
+static int num_startup_events;
+static std::mutex startup_lock;
+
+static int out_width[MAX_OUTPUTS], out_height[MAX_OUTPUTS];
+static std::mutex view_lock;	// for reading the output sizes from the simulation
+
+/* the latest pointer state, written by the input handlers, and read by the
+ * simulation, which might be running on another thread
+ */
+struct PointerState {
+	int output;		// -1 when the pointer isn't over any of them
+	Vec3 pos;
+	bool stir;
+};
+static PointerState pointer_state = {-1};
+static std::mutex pointer_lock;
+
+static NoiseVolume *turb_vol;
+static std::atomic<NoiseVolume*> turb_next;
+static float turb_next_t;	// set by the build job before handing over turb_next
+static std::atomic<bool> turb_building;
+
+static std::atomic<bool> explode_pending;
+
+// second of the last wall clock tick, from the main loop
+static std::atomic<long> tick_sec;
+
+/* flame parameters which can be changed at runtime through the control
+ * socket. Changes are queued, and applied between simulation updates.
+ */
+struct RuntimeParam {
+	const char *name;
+	size_t offs;	// float field in PSysParam
+};
+
+static const RuntimeParam rt_params[] = {
+	{"spawn_rate", offsetof(PSysParam, spawn_rate)},
+	{"life", offsetof(PSysParam, life)},
+	{"life_range", offsetof(PSysParam, life_range)},
+	{"size", offsetof(PSysParam, size)},
+	{"size_range", offsetof(PSysParam, size_range)},
+	{"drag", offsetof(PSysParam, drag)},
+	{"turb_strength", offsetof(PSysParam, turb_strength)},
+	{"density_strength", offsetof(PSysParam, density_strength)},
+	{"density_radius", offsetof(PSysParam, density_radius)},
+	{"cull_contrib", offsetof(PSysParam, cull_contrib)}
+};
+#define NUM_RT_PARAMS	(int)(sizeof rt_params / sizeof *rt_params)
+
+struct ParamChange {
+	int param;
+	float value;
+};
+
+static std::mutex param_lock;
+static std::vector<ParamChange> param_changes;	// guarded by param_lock, like ppflame
 
+// state replayed from a trace
+static std::atomic<bool> replay_done;
+static int replay_ptr_sim = -1;
+static PSysPointer replay_ptr;
+
+static unsigned long trace_frames;
+static double trace_update_sec;
+
+static unsigned long frames_shown, frames_missed;
+
+static bool dump_frames, shot_pending;
+static int dump_frame_num, shot_num, dump_dropped;
+
+static float frame_dt(long long t);
+static void simulate(float dt);
+static bool begin_trails(int output, const PSysParam &pp);
+static bool init_flipbooks();
+static void free_flipbooks();
+static unsigned int flip_key(int c);
+static bool flip_cache_dir(char *buf, int size);
+static void update_flip_clocks();
+static void draw_flip_clocks(int first, int count);
+template <class F> static void flip_glyphs(int idx, F func);
+static void string_pens(const char *str, std::vector<float> *pens);
+static SpawnMap *glyph_spawnmap(int c);
+static void sim_thread_func();
+static Clock *create_clock(const char *tz, int idx, int count);
+static void update_clocks();
+static void update_turbulence();
+static void update_pointer(float dt);
+static void set_pointer(int sim, const PSysPointer *ptr);
+static void update_view();
+static void set_view(int sim, const Vec3 &vmin, const Vec3 &vmax);
+static void switch_turbulence(NoiseVolume *vol);
+static void explode_clocks();
+static void apply_param_changes();
+static void scale_params(PSysParam *pp);
+static float *param_field(PSysParam *pp, int param);
+static void replay_events(const TraceFrame *frame);
+static bool init_trace(TraceHeader *hdr);
+static void finish_trace();
+static void burst_changed(int idx, const char *prev, const char *str);
+static void render_time(unsigned char *pixels, const char *str, std::vector<float> *cell_end = 0);
+static SpawnMap *outline_spawnmap(const char *str);
+static std::shared_ptr<SpawnMapJob> start_spawnmap_job(const char *str, unsigned int seed);
+static SpawnMap *raster_spawnmap(unsigned char *pixels, unsigned int seed,
+		const std::vector<float> &cell_end);
+static void format_time(const Clock *clk, time_t t, char *buf);
+static void zone_time(const Clock *clk, time_t t, struct tm *tm);
+static void update_zones(time_t t);
+static void set_tz(const char *tz);
+static long zone_offset(time_t t);
+static void print_stats();
+static void format_stats(char *buf, int size);
+static void print_startup();
+static long long get_nsec();
 static unsigned long get_msec();
+static double get_sec();
 static const char *find_data_file(const char *fname);
+static void capture_frame(const char *fname);
+
+
+bool app_preload()
+{
+	// a replayed trace decides the setup of the simulation
+	if(opt.replay_fname) {
+		if(!trace_replay(opt.replay_fname, &trace_hdr)) {
+			return false;
+		}
+		opt.raster_spawn = trace_hdr.flags & TRACE_RASTER_SPAWN;
+		opt.compact = trace_hdr.flags & TRACE_COMPACT;
+		opt.no_turbulence = !(trace_hdr.flags & TRACE_TURBULENCE);
+		opt.density = trace_hdr.flags & TRACE_DENSITY;
+		opt.trails = trace_hdr.flags & TRACE_TRAILS;
+	}
+
+	/* the font rasterization, glyph triangulation, and the first turbulence
+	 * field take the bulk of the startup time, and none of them touch GL
+	 */
+	get_thread_pool()->add_job([]() {
+		font = dtx_open_font(find_data_file("urw_bookman.type1"), 55);
+		app_startup_mark("font loaded");
+
+		if(!opt.raster_spawn && outlines.open(find_data_file("urw_bookman.type1"), 55)) {
+			use_outlines = true;
+
+			// every glyph a clock can show ends up in the outline cache
+			std::vector<Vec3> tris;
+			outlines.string_mesh("0123456789:.", 0, 0, &tris);
+			app_startup_mark("glyphs triangulated");
+		}
 
+		if(!opt.no_turbulence) {
+			turb_vol = new NoiseVolume;
+			turb_vol->build(NOISE_VOL_SIZE, TURB_SEED, 0.0f);
+			app_startup_mark("turbulence built");
+		}
+	});
+	preloading = true;
+	return true;
+}
 
 bool app_init()
 {
 	glClearColor(0, 0, 0, 0);
 
-	time_image = new Image;
-	time_image->width = 256;
-	time_image->height = 128;
-	time_image->bpp = 32;
-	time_image->pixels = new unsigned char[time_image->width * time_image->height * 4];
-	memset(time_image->pixels, 0, time_image->width * time_image->height * 4);
-
+	if(!preloading && !app_preload()) {
+		return false;
+	}
+	get_thread_pool()->wait();
+	preloading = false;
 
-	if(!(font = dtx_open_font(find_data_file("urw_bookman.type1"), 55))) {
+	if(!font) {
 		fprintf(stderr, "failed to load font\n");
 		return false;
 	}
-	dtx_target_raster(time_image->pixels, time_image->width, time_image->height);
 	dtx_set(DTX_RASTER_THRESHOLD, 128);
 	dtx_color(1, 1, 1, 1);
 
+	if(!opt.raster_spawn && !use_outlines) {
+		fprintf(stderr, "falling back to spawning from rasterized text\n");
+	}
+
 	pimg = new Image;
 	pimg->pixels = (unsigned char*)img_particle.pixel_data;
 	pimg->width = img_particle.width;
 	pimg->height = img_particle.height;
 	pimg->bpp = 32;
 
-	// flame parameters
+	// flame parameters, over the defaults of anything not set here
+	psys_default(&ppflame);
 	ppflame.life = 0.45;
 	ppflame.life_range = 0.25;
 	ppflame.size = 0.12;
@@ -80,7 +382,6 @@ bool app_init()
 	ppflame.spawn_rate = 8000;
 	ppflame.gravity = Vec3(0, 1.5, 0);
 	ppflame.pimg = pimg;
-	ppflame.spawn_map = time_image;
 
 	ppflame.pcolor_start = Vec3(1.0, 0.7, 0.3) * 0.5;
 	ppflame.pcolor_mid = Vec3(1.0, 0.25, 0.15) * 0.5;
@@ -96,48 +397,324 @@ bool app_init()
 	ppflame.pscale_mid = 2.0;
 	ppflame.pscale_end = 3.5;
 
-	psys.pp = ppflame;
+	/* trails keep each frame around at half its brightness for another frame
+	 * (at 60Hz), which makes up for half the particles
+	 */
+	if(opt.trails && !gl_fbo_supported()) {
+		fprintf(stderr, "trails need framebuffer objects, disabling them\n");
+		opt.trails = false;
+	}
+	if(opt.trails) {
+		ppflame.spawn_rate *= 0.5;
+		ppflame.trail_halflife = 1.0 / 60.0;
+		ppflame.trail_drift = Vec3(0, 0.5, 0);
+	}
+
+	if(turb_vol) {
+		ppflame.turb = turb_vol;
+		ppflame.turb_strength = 1.5;
+		ppflame.turb_freq = 6.0;
+	}
+	if(opt.density) {
+		ppflame.density_strength = 0.5;
+		ppflame.density_radius = 0.03;
+	}
+
+	if(getenv("TZ")) {
+		orig_tz = strdup(getenv("TZ"));
+	}
+
+	// nothing is simulated, so there's nothing to trace either
+	if(opt.flipbook && (opt.trace_fname || trace_replaying())) {
+		fprintf(stderr, "flipbooks can't be traced, simulating the flames instead\n");
+		opt.flipbook = false;
+	}
+
+	num_sims = opt.split_outputs && opt.num_outputs > 1 ? opt.num_outputs : 1;
+	clocks_per_sim = opt.num_zones > 0 ? opt.num_zones : 1;
+	if(trace_replaying()) {
+		num_sims = trace_hdr.num_sims;
+		clocks_per_sim = trace_hdr.clocks_per_sim;
+	}
+	if(num_sims * clocks_per_sim > MAX_OUTPUTS * MAX_ZONES) {
+		fprintf(stderr, "too many clocks\n");
+		return false;
+	}
+
+	for(int i=0; i<num_sims; i++) {
+		for(int j=0; j<clocks_per_sim; j++) {
+			// replayed clocks show the strings from the trace, not their time zone
+			const char *tz = j < opt.num_zones && !trace_replaying() ? opt.zones[j] : 0;
+			clocks[num_clocks++] = create_clock(tz, j, clocks_per_sim);
+		}
+	}
+	for(int i=0; i<num_clocks; i++) {
+		clock_psys[i] = &clocks[i]->psys;
+
+		// explicit seeds, for a trace to reproduce
+		unsigned int seed = trace_replaying() ? trace_hdr.seed[i] : (i + 1) * 0x9e3779b9;
+		clock_psys[i]->seed(seed);
+		trace_hdr.seed[i] = seed;
+	}
+
+	if(!init_trace(&trace_hdr)) {
+		return false;
+	}
+	if(opt.flipbook && !init_flipbooks()) {
+		return false;
+	}
+
+	// carry on with the flames of the previous run, traces always start afresh
+	bool use_ckpt = opt.ckpt_fname && !opt.trace_fname && !trace_replaying() && !opt.flipbook;
+	if(use_ckpt && ckpt_load(opt.ckpt_fname, clock_psys, num_clocks)) {
+		printf("restored particle state from %s\n", opt.ckpt_fname);
+	}
+
+	if(!tick_sec) {
+		tick_sec = time(0);	// until the first tick
+	}
+	update_zones(tick_sec);
+
+	// a flipbook frame takes next to nothing to produce
+	if(opt.pipeline && !opt.flipbook) {
+		get_msec();	// set the time origin before there's another thread calling it
+		sim_quit = false;
+		sim_frames_requested = 1;	// start on the first frame right away
+		sim_thread = std::thread(sim_thread_func);
+	}
 	return true;
 }
 
 void app_cleanup()
 {
+	if(sim_thread.joinable()) {
+		{
+			std::unique_lock<std::mutex> lock(sim_lock);
+			sim_quit = true;
+		}
+		sim_cond.notify_all();
+		sim_thread.join();
+	}
+
+	img_write_wait();
+	get_thread_pool()->wait();	// for a turbulence rebuild in progress
+
+	finish_trace();
+
+	if(opt.ckpt_fname && !opt.trace_fname && !opt.replay_fname && !opt.flipbook && num_clocks > 0) {
+		ckpt_save(opt.ckpt_fname, clock_psys, num_clocks);
+	}
+
+	for(int i=0; i<num_clocks; i++) {
+		if(clocks[i]->spawn_map) {
+			delete [] clocks[i]->spawn_map->pixels;
+			clocks[i]->spawn_map->pixels = 0;
+			delete clocks[i]->spawn_map;
+		}
+		delete clocks[i];
+	}
+	num_clocks = 0;
+
+	outlines.close();
+	free_flipbooks();
+
+	for(int i=0; i<MAX_OUTPUTS; i++) {
+		delete trails[i];
+		trails[i] = 0;
+	}
+
+	delete turb_next.exchange(0);
+	delete turb_vol;
+	turb_vol = 0;
+
 	delete pimg;
+	free(orig_tz);
 }
 
-void app_draw()
+void app_update(long long present, long long interval)
 {
-	static unsigned long prev_msec;
-	unsigned long msec = get_msec();
-	float dt = (msec - prev_msec) / 1000.0;
-	prev_msec = msec;
+	if(replay_done) {
+		app_quit();
+		return;
+	}
 
-	time_t t = time(0);
-	struct tm *tm = localtime(&t);
-	char buf[64];
-	sprintf(buf, "%2d:%02d.%02d", tm->tm_hour, tm->tm_min, tm->tm_sec);
+	if(opt.stats) {
+		static unsigned long prev_stats_msec;
+		unsigned long msec = get_msec();
+		if(msec - prev_stats_msec >= STATS_INTERVAL) {
+			print_stats();
+			prev_stats_msec = msec;
+		}
+	}
 
-	memset(time_image->pixels, 0, time_image->width * time_image->height * 4);
-	dtx_position(0, dtx_line_height());
-	dtx_string(buf);
-	//dtx_string("88:88.88");
-	psys.reset_spawnmap();
+	if(opt.pipeline && !opt.flipbook) {
+		// take the latest finished frame, and let the simulation start on the next
+		cur_snap = snapshots.acquire();
+		{
+			// the frame simulated now is shown one frame later
+			std::unique_lock<std::mutex> lock(sim_lock);
+			sim_present = present && interval ? present + interval : 0;
+			sim_frames_requested++;
+		}
+		sim_cond.notify_all();
+	} else {
+		simulate(frame_dt(present));
+	}
+}
+
+void app_draw(int output)
+{
+	int sim = 0;
+	if(opt.split_outputs && output < num_sims) {
+		sim = output;
+	}
+	int first = sim * clocks_per_sim;
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	bool use_trails = begin_trails(output, clock_psys[first]->pp);
+	if(!use_trails) {
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
 
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
-	glTranslatef(0, -0.1, 0);
-	glScalef(0.9, 0.9, 0.9);
+	glTranslatef(0, VIEW_OFFSET_Y, 0);
+	glScalef(VIEW_SCALE, VIEW_SCALE, VIEW_SCALE);
+
+	// all clocks of this output are drawn in one batch
+	if(opt.flipbook) {
+		draw_flip_clocks(first, clocks_per_sim);
+	} else if(opt.pipeline) {
+		if(cur_snap && !cur_snap->verts[sim].empty()) {
+			const std::vector<PSysVertex> &verts = cur_snap->verts[sim];
+			clock_psys[first]->draw_snapshot(&verts[0], verts.size());
+		}
+	} else {
+		ParticleSystem::draw_batch(clock_psys + first, clocks_per_sim);
+	}
 
-	psys.update(dt);
-	psys.draw();
+	if(use_trails) {
+		trails[output]->end();
+	}
+
+	if(output > 0) return;	// only capture the first output
+
+	if(shot_pending) {
+		char fname[64];
+		sprintf(fname, "shot%04d.png", shot_num++);
+		capture_frame(fname);
+		shot_pending = false;
+	}
+	if(dump_frames) {
+		char fname[64];
+		sprintf(fname, "frame%06d.png", dump_frame_num++);
+		capture_frame(fname);
+	}
 }
 
-void app_reshape(int x, int y)
+bool app_damage(int output, int *rect)
+{
+	if(output < 0 || output >= MAX_OUTPUTS || out_width[output] <= 0 || out_height[output] <= 0) {
+		return false;
+	}
+
+	int sim = 0;
+	if(opt.split_outputs && output < num_sims) {
+		sim = output;
+	}
+	int first = sim * clocks_per_sim;
+
+	Vec3 bmin = Vec3(1e30, 1e30, 0);
+	Vec3 bmax = Vec3(-1e30, -1e30, 0);
+	bool any = false;
+
+	if(opt.flipbook) {
+		for(int i=0; i<clocks_per_sim; i++) {
+			flip_glyphs(first + i, [&](const FlipBook *fb, const Vec3 &offs, float scale, float weight, float t) {
+				Vec3 cmin, cmax;
+				fb->get_bounds(offs, scale, &cmin, &cmax);
+				if(cmin.x < bmin.x) bmin.x = cmin.x;
+				if(cmax.x > bmax.x) bmax.x = cmax.x;
+				if(cmin.y < bmin.y) bmin.y = cmin.y;
+				if(cmax.y > bmax.y) bmax.y = cmax.y;
+				any = true;
+			});
+		}
+	} else if(opt.pipeline) {
+		if(!cur_snap) return false;
+		const std::vector<PSysVertex> &verts = cur_snap->verts[sim];
+		for(size_t i=0; i<verts.size(); i++) {
+			const PSysVertex &v = verts[i];
+			if(v.pos.x - v.hsz < bmin.x) bmin.x = v.pos.x - v.hsz;
+			if(v.pos.x + v.hsz > bmax.x) bmax.x = v.pos.x + v.hsz;
+			if(v.pos.y - v.hsz < bmin.y) bmin.y = v.pos.y - v.hsz;
+			if(v.pos.y + v.hsz > bmax.y) bmax.y = v.pos.y + v.hsz;
+			any = true;
+		}
+	} else {
+		for(int i=0; i<clocks_per_sim; i++) {
+			Vec3 cmin, cmax;
+			if(!clock_psys[first + i]->get_bounds(&cmin, &cmax)) continue;
+			if(cmin.x < bmin.x) bmin.x = cmin.x;
+			if(cmax.x > bmax.x) bmax.x = cmax.x;
+			if(cmin.y < bmin.y) bmin.y = cmin.y;
+			if(cmax.y > bmax.y) bmax.y = cmax.y;
+			any = true;
+		}
+	}
+	if(!any) return false;
+
+	/* trails go on for as long as it takes to fade out 8 bits, at least, and
+	 * further in the direction of the drift
+	 */
+	const PSysParam &pp = clock_psys[first]->pp;
+	if(opt.trails && pp.trail_halflife > 0.0) {
+		Vec3 ext = pp.trail_drift * (pp.trail_halflife * 8.0);
+		if(ext.x < 0.0) bmin.x += ext.x; else bmax.x += ext.x;
+		if(ext.y < 0.0) bmin.y += ext.y; else bmax.y += ext.y;
+	}
+
+	// same transformation as app_draw and app_reshape, then to pixels
+	int w = out_width[output];
+	int h = out_height[output];
+	float aspect = (float)w / (float)h;
+	float x0 = (bmin.x * VIEW_SCALE + 1.0) * 0.5 * w;
+	float x1 = (bmax.x * VIEW_SCALE + 1.0) * 0.5 * w;
+	float y0 = ((bmin.y * VIEW_SCALE + VIEW_OFFSET_Y) * aspect + 1.0) * 0.5 * h;
+	float y1 = ((bmax.y * VIEW_SCALE + VIEW_OFFSET_Y) * aspect + 1.0) * 0.5 * h;
+
+	if(x1 < 0.0 || y1 < 0.0 || x0 > w || y0 > h) return false;
+	if(x0 < 0.0) x0 = 0.0;
+	if(y0 < 0.0) y0 = 0.0;
+	if(x1 > w) x1 = w;
+	if(y1 > h) y1 = h;
+
+	// a few pixels of margin for the rasterization of the edges
+	int xmin = (int)x0 - 2;
+	int ymin = (int)y0 - 2;
+	int xmax = (int)x1 + 3;
+	int ymax = (int)y1 + 3;
+	if(xmin < 0) xmin = 0;
+	if(ymin < 0) ymin = 0;
+	if(xmax > w) xmax = w;
+	if(ymax > h) ymax = h;
+
+	rect[0] = xmin;
+	rect[1] = ymin;
+	rect[2] = xmax - xmin;
+	rect[3] = ymax - ymin;
+	return true;
+}
+
+void app_reshape(int output, int x, int y)
 {
 	float aspect = (float)x / (float)y;
 
+	if(output >= 0 && output < MAX_OUTPUTS) {
+		std::lock_guard<std::mutex> guard(view_lock);
+		out_width[output] = x;
+		out_height[output] = y;
+	}
+
 	glViewport(0, 0, x, y);
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
@@ -149,36 +726,1251 @@ void app_keyboard(int key, bool press)
 	if(press) {
 		switch(key) {
 		case 27:
-			exit(0);
+			app_quit();
+			break;
 
 		case 'f':
 		case 'F':
 			app_fullscreen_toggle();
 			break;
+
+		case 's':
+			shot_pending = true;
+			break;
+
+		case 'x':
+			explode_pending = true;
+			break;
+
+		case 'd':
+			dump_frames = !dump_frames;
+			if(dump_frames) {
+				printf("dumping frames from frame%06d.png\n", dump_frame_num);
+			} else {
+				printf("stopped dumping frames (%d dropped)\n", dump_dropped);
+				dump_dropped = 0;
+			}
+			break;
+		}
+	}
+}
+
+// any button other than the first (which moves the window) stirs the flames
+void app_mouse_button(int output, int bn, bool press, int x, int y)
+{
+	if(bn == 0) return;
+
+	std::lock_guard<std::mutex> guard(pointer_lock);
+	pointer_state.stir = press;
+}
+
+void app_mouse_motion(int output, int x, int y)
+{
+	std::lock_guard<std::mutex> guard(pointer_lock);
+
+	if(x < 0 || y < 0 || output < 0 || output >= MAX_OUTPUTS || out_width[output] <= 0) {
+		pointer_state.output = -1;
+		pointer_state.stir = false;
+		return;
+	}
+
+	// undo the projection and view transformation of app_reshape and app_draw
+	float aspect = (float)out_width[output] / (float)out_height[output];
+	float nx = 2.0 * x / out_width[output] - 1.0;
+	float ny = 1.0 - 2.0 * y / out_height[output];
+
+	pointer_state.output = output;
+	pointer_state.pos = Vec3(nx / VIEW_SCALE, (ny / aspect - VIEW_OFFSET_Y) / VIEW_SCALE, 0);
+}
+
+void app_tick(long t)
+{
+	update_zones(t);
+	tick_sec = t;
+}
+
+/* commands:
+ *   stats              particle statistics
+ *   get <param>        value of a flame parameter
+ *   set <param> <val>  change a flame parameter, from the next update on
+ *   explode            explode all clocks
+ */
+void app_command(const char *cmd, char *reply, int size)
+{
+	char name[32];
+	float val;
+
+	if(strcmp(cmd, "stats") == 0) {
+		format_stats(reply, size);
+
+	} else if(strcmp(cmd, "explode") == 0) {
+		explode_pending = true;
+		snprintf(reply, size, "ok");
+
+	} else if(sscanf(cmd, "get %31s", name) == 1) {
+		for(int i=0; i<NUM_RT_PARAMS; i++) {
+			if(strcmp(name, rt_params[i].name) == 0) {
+				std::unique_lock<std::mutex> lock(param_lock);
+				snprintf(reply, size, "%s %g", name, *param_field(&ppflame, i));
+				return;
+			}
+		}
+		snprintf(reply, size, "error: unknown parameter: %s", name);
+
+	} else if(sscanf(cmd, "set %31s %f", name, &val) == 2) {
+		// changes aren't part of traces, so they would break them
+		if(trace_recording() || trace_replaying()) {
+			snprintf(reply, size, "error: can't change parameters while tracing");
+			return;
+		}
+		for(int i=0; i<NUM_RT_PARAMS; i++) {
+			if(strcmp(name, rt_params[i].name) == 0) {
+				ParamChange pc = {i, val};
+				std::unique_lock<std::mutex> lock(param_lock);
+				param_changes.push_back(pc);
+				snprintf(reply, size, "ok");
+				return;
+			}
+		}
+		snprintf(reply, size, "error: unknown parameter: %s", name);
+
+	} else {
+		snprintf(reply, size, "error: unknown command, try: stats, get, set, explode");
+	}
+}
+
+void app_presented(int output, long long t, int frames, int missed)
+{
+	frames_shown += frames;
+	frames_missed += missed;
+}
+
+/* time step up to t, or to now if t is 0. Predicted times can be off by a
+ * bit, so never step backwards.
+ */
+static float frame_dt(long long t)
+{
+	static long long prev_t;
+	if(!t) t = get_nsec();
+
+	float dt = prev_t && t > prev_t ? (t - prev_t) / 1000000000.0 : 0.0;
+	if(t > prev_t) prev_t = t;
+	return dt;
+}
+
+/* gather the input of this frame, or read it back from a trace, and update
+ * the simulation
+ */
+static void simulate(float dt)
+{
+	if(opt.flipbook) {
+		flip_time += dt;
+		sim_time += dt;
+		update_flip_clocks();
+		return;
+	}
+
+	if(trace_replaying()) {
+		TraceFrame frame;
+		if(!trace_read_frame(&frame)) {
+			replay_done = true;
+			return;
+		}
+		dt = frame.dt;
+		replay_events(&frame);
+
+	} else {
+		trace_write_frame(dt);
+
+		update_clocks();
+		update_turbulence();
+		update_pointer(dt);
+		update_view();
+		if(explode_pending.exchange(false)) {
+			explode_clocks();
+		}
+		apply_param_changes();
+	}
+	sim_time += dt;
+
+	double t0 = get_sec();
+
+	// the clocks of all outputs are simulated together on the thread pool
+	ParticleSystem::update_batch(clock_psys, num_clocks, dt);
+
+	trace_update_sec += get_sec() - t0;
+	trace_frames++;
+}
+
+static void sim_thread_func()
+{
+	unsigned long frame = 0;
+	long long present;
+
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> lock(sim_lock);
+			while(sim_frames_requested == frame && !sim_quit) {
+				sim_cond.wait(lock);
+			}
+			if(sim_quit) break;
+			frame = sim_frames_requested;
+			present = sim_present;
+		}
+
+		simulate(frame_dt(present));
+
+		Snapshot *snap = snapshots.write_buffer();
+		snap->time = sim_time;
+		for(int i=0; i<num_sims; i++) {
+			snap->verts[i].clear();
+			for(int j=0; j<clocks_per_sim; j++) {
+				clock_psys[i * clocks_per_sim + j]->snapshot(snap->verts + i);
+			}
+		}
+		snapshots.publish();
+	}
+}
+
+/* lay out the clocks in a grid over the area of the single clock, and scale
+ * the flame parameters accordingly
+ */
+static Clock *create_clock(const char *tz, int idx, int count)
+{
+	Clock *clk = new Clock;
+	clk->tz = tz;
+	clk->zone.start = clk->zone.end = clk->zone.change = 0;	// worked out by update_zones
+	clk->zone.offset = clk->zone.next_offset = 0;
+	clk->timestr[0] = 0;
+	clk->prev_timestr[0] = 0;
+	clk->change_time = 0.0;
+
+	// spawning from glyph outlines doesn't need an image at all
+	Image *img = 0;
+	if(!use_outlines) {
+		img = new Image;
+		img->width = SPAWN_MAP_WIDTH;
+		img->height = SPAWN_MAP_HEIGHT;
+		img->bpp = 32;
+		img->pixels = new unsigned char[img->width * img->height * 4];
+		memset(img->pixels, 0, img->width * img->height * 4);
+	}
+	clk->spawn_map = img;
+
+	int cols = 1;
+	while(cols * cols < count) cols++;
+	int rows = (count + cols - 1) / cols;
+	float scale = 1.0 / (cols > rows ? cols : rows);
+
+	float cell_width = 2.0 / cols;
+	float cell_height = 1.0 / rows;
+	clk->psys.pos.x = -1.0 + ((idx % cols) + 0.5) * cell_width;
+	clk->psys.pos.y = 0.5 - ((idx / cols) + 0.5) * cell_height;
+
+	PSysParam *pp = &clk->psys.pp;
+	*pp = ppflame;
+	pp->spawn_map = img;
+	pp->spawn_map_scale = scale;
+	scale_params(pp);
+
+	clk->psys.set_compact(opt.compact);
+
+	// enough for the steady state: spawn rate times the average lifetime
+	if(!opt.flipbook) {
+		clk->psys.reserve((int)(pp->spawn_rate * (pp->life + pp->life_range * 0.5)));
+	}
+	return clk;
+}
+
+/* start drawing a frame of an output into its trails buffer, on top of the
+ * previous one, faded and moved by the time since then. False if the output
+ * has no trails, to draw it directly.
+ */
+static bool begin_trails(int output, const PSysParam &pp)
+{
+	if(!opt.trails || pp.trail_halflife <= 0.0 || output < 0 || output >= MAX_OUTPUTS) {
+		return false;
+	}
+
+	int w, h;
+	{
+		std::lock_guard<std::mutex> guard(view_lock);
+		w = out_width[output];
+		h = out_height[output];
+	}
+	if(w <= 0 || h <= 0) return false;
+
+	if(!trails[output]) {
+		trails[output] = new Trails;
+	}
+	if(!trails[output]->resize(w, h)) {
+		delete trails[output];
+		trails[output] = 0;
+		opt.trails = false;
+		return false;
+	}
+
+	/* fades with the simulated time between the frames it's drawn, which is
+	 * the frame being shown with -pipeline
+	 */
+	double now = sim_time;
+	if(opt.pipeline && !opt.flipbook) {
+		now = cur_snap ? cur_snap->time : trail_time[output];
+	}
+	double dt = trail_time[output] > 0.0 ? now - trail_time[output] : 0.0;
+	if(dt > 0.1) dt = 0.1;
+	trail_time[output] = now;
+
+	// same transformation as app_draw and app_reshape, in pixels
+	float aspect = (float)w / (float)h;
+	float dx = pp.trail_drift.x * dt * VIEW_SCALE * 0.5 * w;
+	float dy = pp.trail_drift.y * dt * VIEW_SCALE * aspect * 0.5 * h;
+	float keep = pow(0.5, dt / pp.trail_halflife);
+
+	trails[output]->begin(dx, dy, keep);
+	return true;
+}
+
+/* pre-simulate a loop of the flames of every glyph, or load it from the
+ * cache if it was simulated with the same parameters before. Falls back to
+ * simulating the flames if the flipbooks can't be made.
+ */
+static bool init_flipbooks()
+{
+	if(!gl_fbo_supported()) {
+		fprintf(stderr, "flipbooks need framebuffer objects, simulating the flames instead\n");
+		opt.flipbook = false;
+		return true;
+	}
+
+	char dir[512], fname[600];
+	bool use_cache = flip_cache_dir(dir, sizeof dir);
+
+	// the spawn rate is meant for a whole string, each glyph gets its share by width
+	std::vector<float> pens;
+	string_pens(FLIP_REF_STRING, &pens);
+	float ref_width = pens.back();
+
+	std::vector<ParticleSystem*> psys;
+	std::vector<int> chars;
+
+	for(const char *g=FLIP_GLYPHS; *g; g++) {
+		int c = (unsigned char)*g;
+		flipbooks[c] = new FlipBook;
+
+		if(use_cache) {
+			snprintf(fname, sizeof fname, "%s/glyph%02x.flip", dir, c);
+			if(flipbooks[c]->load(fname, flip_key(c))) {
+				continue;
+			}
+		}
+
+		char str[2] = {(char)c, 0};
+		string_pens(str, &pens);
+
+		ParticleSystem *ps = new ParticleSystem;
+		ps->pp = ppflame;
+		ps->pp.spawn_map_scale = 1.0;
+		ps->pp.spawn_rate *= ref_width > 0.0 ? pens.back() / ref_width : 0.0;
+		ps->seed((c + 1) * 0x9e3779b9);
+		ps->set_spawnmap(glyph_spawnmap(c));
+		psys.push_back(ps);
+		chars.push_back(c);
+	}
+
+	bool ok = true;
+	if(!psys.empty()) {
+		std::vector<std::vector<PSysVertex>> frames(psys.size() * FLIP_SIM_FRAMES);
+		flip_simulate(&psys[0], psys.size(), FLIP_WARMUP, &frames[0]);
+
+		for(size_t i=0; i<psys.size(); i++) {
+			int c = chars[i];
+			if(ok && !(ok = flipbooks[c]->create(psys[i], &frames[i * FLIP_SIM_FRAMES]))) {
+				fprintf(stderr, "failed to create flipbooks, simulating the flames instead\n");
+			}
+			if(ok && use_cache) {
+				snprintf(fname, sizeof fname, "%s/glyph%02x.flip", dir, c);
+				flipbooks[c]->save(fname, flip_key(c));
+			}
+			delete psys[i];
+		}
+	}
+
+	if(!ok) {
+		free_flipbooks();
+		opt.flipbook = false;
+		return true;
+	}
+	app_startup_mark(psys.empty() ? "flipbooks loaded" : "flipbooks simulated");
+	return true;
+}
+
+static void free_flipbooks()
+{
+	for(int i=0; i<256; i++) {
+		delete flipbooks[i];
+		flipbooks[i] = 0;
+	}
+}
+
+// hash of everything that goes into the flipbook of glyph c
+static unsigned int flip_key(int c)
+{
+	const PSysParam &pp = ppflame;
+	float fval[] = {
+		pp.spawn_rate, pp.life, pp.life_range, pp.size, pp.size_range,
+		pp.gravity.x, pp.gravity.y, pp.gravity.z,
+		pp.turb ? pp.turb_strength : 0.0f, pp.turb_freq, pp.density_strength, pp.density_radius,
+		pp.pcolor_start.x, pp.pcolor_start.y, pp.pcolor_start.z,
+		pp.pcolor_mid.x, pp.pcolor_mid.y, pp.pcolor_mid.z,
+		pp.pcolor_end.x, pp.pcolor_end.y, pp.pcolor_end.z,
+		pp.palpha_start, pp.palpha_mid, pp.palpha_end,
+		pp.pscale_start, pp.pscale_mid, pp.pscale_end, pp.cull_contrib,
+		(float)FLIP_WARMUP
+	};
+	int ival[] = {
+		c, use_outlines, FLIP_FRAMES, FLIP_FADE, FLIP_FPS, FLIP_SUBSTEPS, FLIP_TEXELS,
+		SPAWN_MAP_WIDTH, SPAWN_MAP_HEIGHT, TURB_SEED
+	};
+
+	unsigned int hash = 2166136261u;	// FNV-1a
+	const unsigned char *ptr = (const unsigned char*)fval;
+	for(size_t i=0; i<sizeof fval; i++) {
+		hash = (hash ^ ptr[i]) * 16777619u;
+	}
+	ptr = (const unsigned char*)ival;
+	for(size_t i=0; i<sizeof ival; i++) {
+		hash = (hash ^ ptr[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/* $XDG_CACHE_HOME/alphaclock, or ~/.cache/alphaclock, created along with
+ * its parent if needed. buf is left alone if there's neither.
+ */
+static bool flip_cache_dir(char *buf, int size)
+{
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+
+	if(xdg && *xdg) {
+		mkdir(xdg, 0700);
+		snprintf(buf, size, "%s/%s", xdg, APP_NAME);
+	} else if(home && *home) {
+		snprintf(buf, size, "%s/.cache", home);
+		mkdir(buf, 0700);
+		snprintf(buf, size, "%s/.cache/%s", home, APP_NAME);
+	} else {
+		return false;
+	}
+	return mkdir(buf, 0700) == 0 || errno == EEXIST;
+}
+
+/* flipbook mode: nothing is simulated, the clocks only keep track of their
+ * strings, and of when they last changed
+ */
+static void update_flip_clocks()
+{
+	static time_t prev_t = -1;
+
+	time_t t = tick_sec;
+	if(t == prev_t) return;
+	prev_t = t;
+
+	for(int i=0; i<num_clocks; i++) {
+		Clock *clk = clocks[i];
+
+		char buf[64];
+		format_time(clk, t, buf);
+		if(strcmp(buf, clk->timestr) == 0) continue;
+
+		strcpy(clk->prev_timestr, clk->timestr);
+		clk->prev_pens.swap(clk->pens);
+		strcpy(clk->timestr, buf);
+		string_pens(buf, &clk->pens);
+		clk->change_time = flip_time;
+	}
+}
+
+static void draw_flip_clocks(int first, int count)
+{
+	FlipBook::begin_draw();
+	for(int i=0; i<count; i++) {
+		flip_glyphs(first + i, [](const FlipBook *fb, const Vec3 &offs, float scale, float weight, float t) {
+			fb->draw(t, offs, scale, weight);
+		});
+	}
+	FlipBook::end_draw();
+}
+
+/* call func(flipbook, offset, scale, weight, time) for every glyph a clock
+ * shows in flipbook mode, and for the changed glyphs of its previous string
+ * while they fade out. Each character runs its loop at a different point,
+ * so that equal glyphs don't flicker in step.
+ */
+template <class F>
+static void flip_glyphs(int idx, F func)
+{
+	const Clock *clk = clocks[idx];
+	float scale = clk->psys.pp.spawn_map_scale;
+	float fade = (flip_time - clk->change_time) / FLIP_CHANGE_DUR;
+	if(fade > 1.0) fade = 1.0;
+
+	/* scaled down clocks keep their particle count per area, with smaller
+	 * particles, which makes their flames fainter by the square of the scale
+	 */
+	float brightness = scale * scale;
+
+	for(int i=0; i<2; i++) {
+		const char *str = i ? clk->prev_timestr : clk->timestr;
+		const char *other = i ? clk->timestr : clk->prev_timestr;
+		const std::vector<float> &pens = i ? clk->prev_pens : clk->pens;
+		const std::vector<float> &other_pens = i ? clk->pens : clk->prev_pens;
+		int other_len = strlen(other);
+
+		for(int j=0; str[j] && j<(int)pens.size(); j++) {
+			bool changed = j >= other_len || other[j] != str[j] || other_pens[j] != pens[j];
+			if(i && !changed) continue;		// drawn once, with the current string
+
+			float weight = changed ? (i ? 1.0 - fade : fade) : 1.0;
+			const FlipBook *fb = flipbooks[(unsigned char)str[j]];
+			if(!fb || weight <= 0.0) continue;
+
+			Vec3 offs = clk->psys.pos + Vec3(pens[j] * 2.0 / SPAWN_MAP_WIDTH * scale, 0, 0);
+			float t = flip_time + (idx * PSYS_MAX_CELLS + j) * 0.618034 * FLIP_FRAMES / FLIP_FPS;
+			func(fb, offs, scale, weight * brightness, t);
+		}
+	}
+}
+
+// pen position before each character of a string and after the last, in spawn map pixels
+static void string_pens(const char *str, std::vector<float> *pens)
+{
+	int len = strlen(str);
+	pens->resize(len + 1);
+
+	if(use_outlines) {
+		std::vector<Vec3> tris;
+		std::vector<float> cell_end;
+		outlines.string_mesh(str, 0, 0, &tris, &cell_end);
+		for(int i=0; i<=len; i++) {
+			(*pens)[i] = i ? cell_end[i - 1] : 0.0f;
+		}
+	} else {
+		for(int i=0; i<=len; i++) {
+			(*pens)[i] = dtx_char_pos(str, i);
+		}
+	}
+}
+
+// spawn map of a single glyph, with the pen at the left edge
+static SpawnMap *glyph_spawnmap(int c)
+{
+	char str[2] = {(char)c, 0};
+	if(use_outlines) {
+		return outline_spawnmap(str);
+	}
+
+	std::vector<unsigned char> pixels(SPAWN_MAP_WIDTH * SPAWN_MAP_HEIGHT * 4);
+	std::vector<float> cell_end;
+	render_time(&pixels[0], str, &cell_end);
+	return raster_spawnmap(&pixels[0], (c + 1) * 0x9e3779b9, cell_end);
+}
+
+/* format the time for each clock, and switch to the spawn map of the new time
+ * string. Outline spawn maps are just the cached glyph triangles copied into
+ * place, so they're built right on the tick. Raster spawn maps are built a
+ * second in advance on the thread pool, so on the tick itself all that's
+ * left to do is hand the new one over.
+ */
+static void update_clocks()
+{
+	static time_t prev_t = -1;
+
+	time_t t = tick_sec;
+	if(t == prev_t) return;
+	prev_t = t;
+
+	for(int i=0; i<num_clocks; i++) {
+		Clock *clk = clocks[i];
+
+		char buf[64];
+		format_time(clk, t, buf);
+
+		TraceEvent ev;
+		ev.type = TRACE_EV_STRING;
+		ev.clock = i;
+		strcpy(ev.str, buf);
+		ev.prebuilt = false;
+		ev.seed = 0;
+
+		if(use_outlines) {
+			if(strcmp(buf, clk->timestr) != 0) {
+				burst_changed(i, clk->timestr, buf);
+				strcpy(clk->timestr, buf);
+				clk->psys.set_spawnmap(outline_spawnmap(buf));
+				trace_write_event(&ev);
+			}
+			continue;
+		}
+
+		if(strcmp(buf, clk->timestr) != 0) {
+			burst_changed(i, clk->timestr, buf);
+			strcpy(clk->timestr, buf);
+
+			SpawnMap *sm = 0;
+			if(clk->next_map && strcmp(clk->next_map->timestr, buf) == 0) {
+				sm = clk->next_map->map.exchange(0);
+			}
+			if(sm) {
+				ev.prebuilt = true;
+				ev.seed = clk->next_map->seed;
+				trace_write_event(&ev);
+
+				clk->psys.set_spawnmap(sm);
+			} else {
+				trace_write_event(&ev);
+
+				/* not ready in time (first frame, clock jumps, or the pool is
+				 * busy), so fall back to rebuilding it during the next update
+				 */
+				render_time(clk->spawn_map->pixels, buf);
+				clk->psys.reset_spawnmap();
+			}
+		}
+
+		// start working on the next second, unless it's already underway
+		char next[64];
+		format_time(clk, t + 1, next);
+		if(strcmp(next, buf) != 0 && !(clk->next_map && strcmp(clk->next_map->timestr, next) == 0)) {
+			clk->next_map = start_spawnmap_job(next, (i + 1) * 0x9e3779b9 ^ (unsigned int)(t + 1));
+		}
+	}
+}
+
+/* switch all clocks to the last turbulence field built in the background,
+ * between updates, and start building the next one when it's due
+ */
+static void update_turbulence()
+{
+	static unsigned long prev_build_msec;
+
+	if(!turb_vol) return;
+
+	NoiseVolume *vol = turb_next.exchange(0);
+	if(vol) {
+		TraceEvent ev;
+		ev.type = TRACE_EV_TURB;
+		ev.t = turb_next_t;
+		trace_write_event(&ev);
+
+		switch_turbulence(vol);
+	}
+
+	unsigned long msec = get_msec();
+	if(msec - prev_build_msec >= TURB_REBUILD_INTERVAL && !turb_building) {
+		prev_build_msec = msec;
+		turb_building = true;
+
+		float t = msec / 1000.0 * TURB_EVOLVE_RATE;
+		get_thread_pool()->add_job([t]() {
+			NoiseVolume *vol = new NoiseVolume;
+			vol->build(NOISE_VOL_SIZE, TURB_SEED, t);
+			turb_next_t = t;
+			delete turb_next.exchange(vol);
+			turb_building = false;
+		});
+	}
+}
+
+/* let the clocks shown on the output under the pointer react to it. The
+ * pointer velocity is tracked here, to drag particles along when stirring.
+ */
+static void update_pointer(float dt)
+{
+	static Vec3 prev_pos;
+	static int prev_output = -1;
+
+	PointerState ps;
+	{
+		std::lock_guard<std::mutex> guard(pointer_lock);
+		ps = pointer_state;
+	}
+
+	PSysPointer ptr;
+	ptr.pos = ps.pos;
+	ptr.vel = Vec3(0, 0, 0);
+	if(ps.output >= 0 && ps.output == prev_output && dt > 0.0) {
+		ptr.vel = (ps.pos - prev_pos) * (1.0 / dt);
+	}
+	prev_pos = ps.pos;
+	prev_output = ps.output;
+
+	ptr.radius = POINTER_RADIUS;
+	ptr.repel = ps.stir ? 0.0 : POINTER_REPEL;
+	ptr.stir = ps.stir ? POINTER_STIR : 0.0;
+
+	// all outputs show the first simulation, unless they're split
+	int sim = -1;
+	if(ps.output >= 0) {
+		sim = opt.split_outputs && ps.output < num_sims ? ps.output : 0;
+	}
+	set_pointer(sim, &ptr);
+
+	if(trace_recording()) {
+		static int prev_sim = -1;
+		static PSysPointer prev_ptr;
+
+		if(sim != prev_sim || (sim >= 0 && memcmp(&ptr, &prev_ptr, sizeof ptr) != 0)) {
+			TraceEvent ev;
+			ev.type = TRACE_EV_POINTER;
+			ev.clock = sim;
+			ev.ptr = ptr;
+			trace_write_event(&ev);
+
+			prev_sim = sim;
+			prev_ptr = ptr;
+		}
+	}
+}
+
+// point the clocks of one simulation to the pointer, sim -1 for none
+static void set_pointer(int sim, const PSysPointer *ptr)
+{
+	for(int i=0; i<num_clocks; i++) {
+		if(sim >= 0 && i / clocks_per_sim == sim) {
+			clock_psys[i]->set_pointer(ptr);
+		} else {
+			clock_psys[i]->set_pointer(0);
+		}
+	}
+}
+
+/* the area of the clock space shown on the outputs of each simulation, for
+ * dropping the particles which leave it. Simulations which aren't shown on
+ * any output yet keep on simulating everything.
+ */
+static void update_view()
+{
+	static Vec3 prev_min[MAX_OUTPUTS], prev_max[MAX_OUTPUTS];
+
+	int width[MAX_OUTPUTS], height[MAX_OUTPUTS];
+	{
+		std::lock_guard<std::mutex> guard(view_lock);
+		memcpy(width, out_width, sizeof width);
+		memcpy(height, out_height, sizeof height);
+	}
+
+	for(int sim=0; sim<num_sims; sim++) {
+		Vec3 vmin = Vec3(1e30, 1e30, 0);
+		Vec3 vmax = Vec3(-1e30, -1e30, 0);
+		bool shown = false;
+
+		for(int i=0; i<MAX_OUTPUTS; i++) {
+			if(width[i] <= 0 || height[i] <= 0) continue;
+			int osim = opt.split_outputs && i < num_sims ? i : 0;
+			if(osim != sim) continue;
+
+			// undo the projection and view transformation of app_reshape and app_draw
+			float aspect = (float)width[i] / (float)height[i];
+			float x = 1.0 / VIEW_SCALE;
+			float y0 = (-1.0 / aspect - VIEW_OFFSET_Y) / VIEW_SCALE;
+			float y1 = (1.0 / aspect - VIEW_OFFSET_Y) / VIEW_SCALE;
+
+			if(-x < vmin.x) vmin.x = -x;
+			if(x > vmax.x) vmax.x = x;
+			if(y0 < vmin.y) vmin.y = y0;
+			if(y1 > vmax.y) vmax.y = y1;
+			shown = true;
+		}
+		if(!shown || (vmin.x == prev_min[sim].x && vmin.y == prev_min[sim].y &&
+					vmax.x == prev_max[sim].x && vmax.y == prev_max[sim].y)) {
+			continue;
+		}
+		prev_min[sim] = vmin;
+		prev_max[sim] = vmax;
+
+		TraceEvent ev;
+		ev.type = TRACE_EV_VIEW;
+		ev.clock = sim;
+		ev.vmin = vmin;
+		ev.vmax = vmax;
+		trace_write_event(&ev);
+
+		set_view(sim, vmin, vmax);
+	}
+}
+
+static void set_view(int sim, const Vec3 &vmin, const Vec3 &vmax)
+{
+	for(int i=0; i<clocks_per_sim; i++) {
+		clock_psys[sim * clocks_per_sim + i]->set_view(vmin, vmax);
+	}
+}
+
+static void switch_turbulence(NoiseVolume *vol)
+{
+	for(int i=0; i<num_clocks; i++) {
+		clock_psys[i]->pp.turb = vol;
+	}
+	delete turb_vol;
+	turb_vol = vol;
+}
+
+static void explode_clocks()
+{
+	for(int i=0; i<num_clocks; i++) {
+		TraceEvent ev;
+		ev.type = TRACE_EV_EXPLODE;
+		ev.clock = i;
+		ev.cent = Vec3(0, 0, 0);
+		ev.force = EXPLODE_FORCE * clock_psys[i]->pp.spawn_map_scale;
+		ev.dur = EXPLODE_DUR;
+		ev.life = 0.0;
+		trace_write_event(&ev);
+
+		clock_psys[i]->explode(ev.cent, ev.force, ev.dur, ev.life);
+	}
+}
+
+/* ppflame keeps the unscaled value, and each clock gets it scaled to its
+ * own size, the same way create_clock did
+ */
+static void apply_param_changes()
+{
+	std::unique_lock<std::mutex> lock(param_lock);
+	for(size_t i=0; i<param_changes.size(); i++) {
+		const ParamChange &pc = param_changes[i];
+		*param_field(&ppflame, pc.param) = pc.value;
+		for(int j=0; j<num_clocks; j++) {
+			PSysParam pp = ppflame;
+			pp.spawn_map_scale = clock_psys[j]->pp.spawn_map_scale;
+			scale_params(&pp);
+			*param_field(&clock_psys[j]->pp, pc.param) = *param_field(&pp, pc.param);
+		}
+	}
+	param_changes.clear();
+}
+
+// scale the flame parameters down to a clock of size spawn_map_scale
+static void scale_params(PSysParam *pp)
+{
+	float scale = pp->spawn_map_scale;
+	pp->spawn_rate *= scale * scale;	// same density over a smaller area
+	pp->size *= scale;
+	pp->size_range *= scale;
+	pp->gravity = pp->gravity * scale;
+	pp->turb_strength *= scale;
+	pp->turb_freq /= scale;
+	pp->density_radius *= scale;
+}
+
+static float *param_field(PSysParam *pp, int param)
+{
+	return (float*)((char*)pp + rt_params[param].offs);
+}
+
+/* apply the input of a frame read back from a trace, the same way it was
+ * applied when it was recorded. Anything which was built in the background
+ * is built right here, from the same parameters.
+ */
+static void replay_events(const TraceFrame *frame)
+{
+	for(size_t i=0; i<frame->events.size(); i++) {
+		const TraceEvent *ev = &frame->events[i];
+
+		switch(ev->type) {
+		case TRACE_EV_STRING:
+			if(ev->clock < num_clocks) {
+				Clock *clk = clocks[ev->clock];
+				strcpy(clk->timestr, ev->str);
+
+				if(use_outlines) {
+					clk->psys.set_spawnmap(outline_spawnmap(ev->str));
+				} else if(ev->prebuilt) {
+					std::vector<unsigned char> pixels(SPAWN_MAP_WIDTH * SPAWN_MAP_HEIGHT * 4);
+					std::vector<float> cell_end;
+					render_time(&pixels[0], ev->str, &cell_end);
+					clk->psys.set_spawnmap(raster_spawnmap(&pixels[0], ev->seed, cell_end));
+				} else {
+					render_time(clk->spawn_map->pixels, ev->str);
+					clk->psys.reset_spawnmap();
+				}
+			}
+			break;
+
+		case TRACE_EV_TURB:
+			if(turb_vol) {
+				NoiseVolume *vol = new NoiseVolume;
+				vol->build(NOISE_VOL_SIZE, TURB_SEED, ev->t);
+				switch_turbulence(vol);
+			}
+			break;
+
+		case TRACE_EV_POINTER:
+			replay_ptr_sim = ev->clock;
+			replay_ptr = ev->ptr;
+			break;
+
+		case TRACE_EV_EXPLODE:
+			if(ev->clock < num_clocks) {
+				clock_psys[ev->clock]->explode(ev->cent, ev->force, ev->dur, ev->life);
+			}
+			break;
+
+		case TRACE_EV_BURST:
+			if(ev->clock < num_clocks) {
+				clock_psys[ev->clock]->explode_cell(ev->cell, ev->force, ev->dur);
+			}
+			break;
+
+		case TRACE_EV_VIEW:
+			if(ev->clock < num_sims) {
+				set_view(ev->clock, ev->vmin, ev->vmax);
+			}
+			break;
+		}
+	}
+
+	set_pointer(replay_ptr_sim, &replay_ptr);
+}
+
+// start recording a trace if requested, after the clocks are created
+static bool init_trace(TraceHeader *hdr)
+{
+	if(!opt.trace_fname || trace_replaying()) {
+		return true;
+	}
+
+	hdr->flags = 0;
+	if(!use_outlines) hdr->flags |= TRACE_RASTER_SPAWN;
+	if(opt.compact) hdr->flags |= TRACE_COMPACT;
+	if(turb_vol) hdr->flags |= TRACE_TURBULENCE;
+	if(opt.density) hdr->flags |= TRACE_DENSITY;
+	if(opt.trails) hdr->flags |= TRACE_TRAILS;
+	hdr->num_sims = num_sims;
+	hdr->clocks_per_sim = clocks_per_sim;
+
+	return trace_record(opt.trace_fname, hdr);
+}
+
+/* print the time spent updating during the trace, and a hash of the final
+ * state of all particles, which matches between a recording and its replay
+ */
+static void finish_trace()
+{
+	if(!trace_recording() && !trace_replaying()) {
+		return;
+	}
+
+	unsigned int hash = 2166136261u;	// FNV-1a
+	std::vector<PSysVertex> verts;
+	for(int i=0; i<num_clocks; i++) {
+		verts.clear();
+		clock_psys[i]->snapshot(&verts);
+
+		const unsigned char *ptr = verts.empty() ? 0 : (const unsigned char*)&verts[0];
+		size_t size = verts.size() * sizeof verts[0];
+		for(size_t j=0; j<size; j++) {
+			hash = (hash ^ ptr[j]) * 16777619u;
+		}
+	}
+
+	printf("trace: %lu frames, %.1f ms updating (%.3f ms/frame), state hash: %08x\n",
+			trace_frames, trace_update_sec * 1000.0,
+			trace_frames ? trace_update_sec * 1000.0 / trace_frames : 0.0, hash);
+	trace_close();
+}
+
+/* burst the flames of the characters which differ between the previous and
+ * the new string of a clock. Each character has its own cell of particles,
+ * so the rest of them aren't touched at all.
+ */
+static void burst_changed(int idx, const char *prev, const char *str)
+{
+	if(!opt.burst || !*prev) return;
+
+	for(int i=0; str[i] && i<PSYS_MAX_CELLS; i++) {
+		if(prev[i] == str[i]) continue;
+
+		TraceEvent ev;
+		ev.type = TRACE_EV_BURST;
+		ev.clock = idx;
+		ev.cell = i;
+		ev.force = BURST_FORCE * clock_psys[idx]->pp.spawn_map_scale;
+		ev.dur = BURST_DUR;
+		trace_write_event(&ev);
+
+		clock_psys[idx]->explode_cell(ev.cell, ev.force, ev.dur);
+	}
+}
+
+/* rasterize a time string into a spawn map sized image, and optionally find
+ * the right edge of each character in it
+ */
+static void render_time(unsigned char *pixels, const char *str, std::vector<float> *cell_end)
+{
+	memset(pixels, 0, SPAWN_MAP_WIDTH * SPAWN_MAP_HEIGHT * 4);
+	dtx_target_raster(pixels, SPAWN_MAP_WIDTH, SPAWN_MAP_HEIGHT);
+	dtx_position(0, dtx_line_height());
+	dtx_string(str);
+	//dtx_string("88:88.88");
+
+	if(cell_end) {
+		int len = strlen(str);
+		cell_end->resize(len);
+		for(int i=0; i<len; i++) {
+			(*cell_end)[i] = dtx_char_pos(str, i + 1);
+		}
+	}
+}
+
+// build a spawn map from the glyph outlines of a time string
+static SpawnMap *outline_spawnmap(const char *str)
+{
+	std::vector<Vec3> tris;
+	std::vector<float> cell_end;
+	outlines.string_mesh(str, 0, outlines.get_line_height(), &tris, &cell_end);
+
+	SpawnMap *sm = new SpawnMap;
+	if(!tris.empty()) {
+		sm->build(&tris[0], tris.size() / 3, SPAWN_MAP_WIDTH, SPAWN_MAP_HEIGHT);
+		sm->set_cells(&cell_end[0], cell_end.size(), SPAWN_MAP_WIDTH);
+	}
+	return sm;
+}
+
+/* the text is rasterized here, since libdrawtext isn't thread-safe, and the
+ * sampling, which is the expensive part, is left to the thread pool
+ */
+static std::shared_ptr<SpawnMapJob> start_spawnmap_job(const char *str, unsigned int seed)
+{
+	std::shared_ptr<SpawnMapJob> job = std::make_shared<SpawnMapJob>();
+	strcpy(job->timestr, str);
+	job->pixels.resize(SPAWN_MAP_WIDTH * SPAWN_MAP_HEIGHT * 4);
+	job->seed = seed;
+	job->map = 0;
+
+	render_time(&job->pixels[0], str, &job->cell_end);
+
+	get_thread_pool()->add_job([job]() {
+		job->map = raster_spawnmap(&job->pixels[0], job->seed, job->cell_end);
+	});
+	return job;
+}
+
+// sample a spawn map from a rasterized time string
+static SpawnMap *raster_spawnmap(unsigned char *pixels, unsigned int seed,
+		const std::vector<float> &cell_end)
+{
+	Image img;
+	img.width = SPAWN_MAP_WIDTH;
+	img.height = SPAWN_MAP_HEIGHT;
+	img.bpp = 32;
+	img.pixels = pixels;
+
+	SpawnMap *sm = new SpawnMap;
+	sm->build(&img, SPAWNMAP_DEF_SAMPLES, seed);
+	if(!cell_end.empty()) {
+		sm->set_cells(&cell_end[0], cell_end.size(), SPAWN_MAP_WIDTH);
+	}
+
+	img.pixels = 0;
+	return sm;
+}
+
+static void format_time(const Clock *clk, time_t t, char *buf)
+{
+	struct tm tm;
+	zone_time(clk, t, &tm);
+	sprintf(buf, "%2d:%02d.%02d", tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+// local time of a clock, from any thread
+static void zone_time(const Clock *clk, time_t t, struct tm *tm)
+{
+	ZoneOffsets zone;
+	{
+		std::lock_guard<std::mutex> guard(zone_lock);
+		zone = clk->zone;
+	}
+
+	t += t < zone.change ? zone.offset : zone.next_offset;
+	gmtime_r(&t, tm);
+}
+
+/* work out the offsets of the clocks' zones from t on, once the ones they
+ * have are about to run out. Main thread only, nothing else may read TZ
+ * while it's switched.
+ */
+static void update_zones(time_t t)
+{
+	bool switched = false;
+
+	for(int i=0; i<num_clocks; i++) {
+		Clock *clk = clocks[i];
+		if(t >= clk->zone.start && t + ZONE_REFRESH < clk->zone.end) {
+			continue;
+		}
+
+		ZoneOffsets zone;
+		zone.start = t;
+		zone.end = zone.change = t + ZONE_SPAN;
+
+		set_tz(clk->tz ? clk->tz : orig_tz);
+		switched = true;
+		zone.offset = zone_offset(zone.start);
+		zone.next_offset = zone_offset(zone.end);
+
+		// zones change at most twice a year, find the second it happens
+		if(zone.next_offset != zone.offset) {
+			time_t lo = zone.start, hi = zone.end;
+			while(hi - lo > 1) {
+				time_t mid = lo + (hi - lo) / 2;
+				if(zone_offset(mid) == zone.offset) {
+					lo = mid;
+				} else {
+					hi = mid;
+				}
+			}
+			zone.change = hi;
 		}
+
+		std::lock_guard<std::mutex> guard(zone_lock);
+		clk->zone = zone;
+	}
+
+	if(switched) {
+		set_tz(orig_tz);
 	}
 }
 
-void app_mouse_button(int bn, bool press, int x, int y)
+// null: unset
+static void set_tz(const char *tz)
 {
+	if(tz) {
+		setenv("TZ", tz, 1);
+	} else {
+		unsetenv("TZ");
+	}
+	tzset();
 }
 
-void app_mouse_motion(int x, int y)
+static long zone_offset(time_t t)
 {
+	struct tm tm;
+	localtime_r(&t, &tm);
+	return tm.tm_gmtoff;
+}
+
+void app_startup_mark(const char *event)
+{
+	std::unique_lock<std::mutex> lock(startup_lock);
+	if(num_startup_events < MAX_STARTUP_EVENTS) {
+		startup_events[num_startup_events].name = event;
+		startup_events[num_startup_events].t = get_sec();
+		num_startup_events++;
+	}
+}
+
+void app_startup_done()
+{
+	app_startup_mark("first frame");
+	if(opt.stats) {
+		print_startup();
+	}
+}
+
+// times of the startup events from the first one, in the order they happened
+static void print_startup()
+{
+	std::unique_lock<std::mutex> lock(startup_lock);
+	if(!num_startup_events) return;
+
+	printf("startup:");
+	for(int i=1; i<num_startup_events; i++) {
+		printf("%s %s %.1f ms", i > 1 ? "," : "", startup_events[i].name,
+				(startup_events[i].t - startup_events[0].t) * 1000.0);
+	}
+	putchar('\n');
+}
+
+static void print_stats()
+{
+	char buf[256];
+	format_stats(buf, sizeof buf);
+	puts(buf);
+}
+
+static void format_stats(char *buf, int size)
+{
+	PArenaStats st, total;
+	unsigned long faded = 0, offview = 0;
+	memset(&total, 0, sizeof total);
+	for(int i=0; i<num_clocks; i++) {
+		unsigned long f, o;
+		clocks[i]->psys.get_cull_stats(&f, &o);
+		faded += f;
+		offview += o;
+
+		clocks[i]->psys.get_stats(&st);
+		total.live += st.live;
+		total.high_water += st.high_water;
+		total.capacity += st.capacity;
+		total.num_chunks += st.num_chunks;
+		total.num_alloc += st.num_alloc;
+		total.num_free += st.num_free;
+	}
+	st = total;
+
+	snprintf(buf, size, "particles: %d live (peak %d), %d capacity in %d chunks, %lu allocs, %lu frees"
+			" - culled: %lu faded, %lu out of view - frames: %lu shown, %lu missed", st.live,
+			st.high_water, st.capacity, st.num_chunks, st.num_alloc, st.num_free, faded, offview,
+			frames_shown, frames_missed);
+}
+
+// CLOCK_MONOTONIC doesn't jump when the system time is adjusted
+static long long get_nsec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
 static unsigned long get_msec()
 {
-	static struct timeval tv0;
-	struct timeval tv;
+	static long long t0 = -1;
+	long long t = get_nsec();
 
-	gettimeofday(&tv, 0);
-	if(tv0.tv_sec == 0 && tv0.tv_usec == 0) {
-		tv0 = tv;
+	if(t0 < 0) {
+		t0 = t;
 		return 0;
 	}
+	return (t - t0) / 1000000;
+}
 
-	return (tv.tv_sec - tv0.tv_sec) * 1000 + (tv.tv_usec - tv0.tv_usec) / 1000;
+static double get_sec()
+{
+	return get_nsec() / 1000000000.0;
+}
+
+/* read back the current frame and hand it over to the thread pool for
+ * encoding, so that capturing doesn't hold up rendering
+ */
+static void capture_frame(const char *fname)
+{
+	int vp[4];
+	glGetIntegerv(GL_VIEWPORT, vp);
+	int width = vp[2];
+	int height = vp[3];
+	if(width <= 0 || height <= 0) return;
+
+	unsigned char *pixels = new unsigned char[width * height * 4];
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+	if(!img_write_async(fname, pixels, width, height, 32, IMG_FMT_AUTO, IMG_FLIP_Y)) {
+		++dump_dropped;
+	}
 }
 
 static const char *find_data_file(const char *fname)
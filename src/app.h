@@ -18,13 +18,70 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef APP_H_
 #define APP_H_
 
+#define MAX_ZONES	16
+#define MAX_OUTPUTS	8
+
+struct Options {
+	bool stats;		// print performance statistics periodically
+
+	// time zones of the clocks, if none are specified show local time
+	const char *zones[MAX_ZONES];
+	int num_zones;
+
+	int num_outputs;		// number of windows, set before app_init
+	bool split_outputs;		// separate simulation for each output
+
+	bool pipeline;			// simulate on a separate thread, one frame ahead
+	bool raster_spawn;		// sample spawn positions from rasterized text
+	bool no_turbulence;		// straight flames, without the noise field
+	bool density;			// spread out crowded particles
+	bool compact;			// 16 byte particles (no density interaction)
+	bool burst;				// burst the flames of each character as it changes
+	bool trails;			// fade the previous frame into the next, with half the particles
+	bool flipbook;			// draw loops of each glyph's flames, simulated in advance
+
+	const char *trace_fname;	// record the simulation input to a trace
+	const char *replay_fname;	// replay a trace instead of running live
+	const char *ckpt_fname;		// particle state saved on exit, restored on startup
+};
+
+extern Options opt;
+
+/* start loading everything which doesn't need a GL context on the thread
+ * pool, while the windows are being created. Called before app_init.
+ */
+bool app_preload();
 bool app_init();
 void app_cleanup();
-void app_draw();
-void app_reshape(int x, int y);
+/* advance the simulation, once per frame for all outputs. present: when the
+ * frame is expected to be shown, in nanoseconds on CLOCK_MONOTONIC, interval:
+ * the time between frames. Either is 0 if unknown, and the simulation
+ * advances to the current time instead.
+ */
+void app_update(long long present, long long interval);
+void app_draw(int output);
+/* region of the output which app_draw will touch, in pixels from the bottom
+ * left: x, y, width, height. Call between app_update and app_draw. Returns
+ * false if nothing will be drawn.
+ */
+bool app_damage(int output, int *rect);
+void app_reshape(int output, int x, int y);
 void app_keyboard(int key, bool press);
-void app_mouse_button(int bn, bool press, int x, int y);
-void app_mouse_motion(int x, int y);
+// bn: 0 for the first button. x, y: window coordinates
+void app_mouse_button(int output, int bn, bool press, int x, int y);
+// x, y are negative when the pointer leaves the window
+void app_mouse_motion(int output, int x, int y);
+
+// frames of an output were shown at time t (as above), after missed refreshes
+void app_presented(int output, long long t, int frames, int missed);
+// the wall clock reached second t (since the epoch), called right on the tick
+void app_tick(long t);
+// run a command from the control socket, and write a one line reply
+void app_command(const char *cmd, char *reply, int size);
+
+// startup timeline, printed with the statistics after the first frame
+void app_startup_mark(const char *event);
+void app_startup_done();
 
 void app_quit();
 void app_redisplay();
@@ -0,0 +1,139 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ckpt.h"
+
+/* file layout, in native byte order:
+ *   magic "ACSTATE1", number of systems
+ *   then for each system, the size of its state and the state itself,
+ *   padded to a multiple of 8 bytes
+ */
+#define CKPT_MAGIC		"ACSTATE1"
+
+struct CkptHeader {
+	char magic[8];
+	unsigned int count;
+	unsigned int pad;
+};
+
+static inline size_t pad8(size_t sz)
+{
+	return (sz + 7) & ~(size_t)7;
+}
+
+bool ckpt_save(const char *fname, ParticleSystem *const *psys, int count)
+{
+	std::vector<char> tmpname(strlen(fname) + 5);
+	sprintf(&tmpname[0], "%s.tmp", fname);
+
+	FILE *fp = fopen(&tmpname[0], "wb");
+	if(!fp) {
+		fprintf(stderr, "failed to open checkpoint file for writing: %s\n", &tmpname[0]);
+		return false;
+	}
+
+	CkptHeader hdr;
+	memcpy(hdr.magic, CKPT_MAGIC, 8);
+	hdr.count = count;
+	hdr.pad = 0;
+	bool ok = fwrite(&hdr, sizeof hdr, 1, fp) == 1;
+
+	std::vector<char> buf;
+	for(int i=0; i<count && ok; i++) {
+		unsigned long long size = psys[i]->state_size();
+		buf.assign(pad8(size), 0);
+		psys[i]->save_state(&buf[0]);
+
+		ok = fwrite(&size, sizeof size, 1, fp) == 1 && fwrite(&buf[0], 1, buf.size(), fp) == buf.size();
+	}
+
+	if(fclose(fp) != 0) ok = false;
+	if(!ok || rename(&tmpname[0], fname) == -1) {
+		fprintf(stderr, "failed to write checkpoint: %s\n", fname);
+		remove(&tmpname[0]);
+		return false;
+	}
+	return true;
+}
+
+bool ckpt_load(const char *fname, ParticleSystem *const *psys, int count)
+{
+	int fd = open(fname, O_RDONLY);
+	if(fd == -1) {
+		return false;	// no checkpoint, not an error
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(CkptHeader)) {
+		fprintf(stderr, "invalid checkpoint file: %s\n", fname);
+		close(fd);
+		return false;
+	}
+	size_t fsize = st.st_size;
+
+	void *data = mmap(0, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		perror("failed to map checkpoint file");
+		return false;
+	}
+
+	const char *ptr = (const char*)data;
+	const char *end = ptr + fsize;
+
+	// find every system's state before restoring any of them
+	std::vector<const char*> states;
+	std::vector<size_t> sizes;
+	const CkptHeader *hdr = (const CkptHeader*)ptr;
+	if(memcmp(hdr->magic, CKPT_MAGIC, 8) == 0 && (int)hdr->count == count) {
+		ptr += sizeof *hdr;
+		for(int i=0; i<count; i++) {
+			unsigned long long size;
+			if(end - ptr < (long)sizeof size) break;
+			memcpy(&size, ptr, sizeof size);
+			ptr += sizeof size;
+
+			if(size > (unsigned long long)(end - ptr)) break;
+			states.push_back(ptr);
+			sizes.push_back(size);
+			ptr += pad8(size) < (size_t)(end - ptr) ? pad8(size) : end - ptr;
+		}
+	}
+
+	int loaded = 0;
+	if((int)states.size() == count) {
+		for(int i=0; i<count; i++) {
+			if(psys[i]->load_state(states[i], sizes[i])) {
+				loaded++;
+			}
+		}
+	}
+	if(loaded < count) {
+		fprintf(stderr, "checkpoint %s doesn't match the current setup, restored %d of %d\n",
+				fname, loaded, count);
+	}
+
+	munmap(data, fsize);
+	return loaded == count;
+}
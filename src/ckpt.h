@@ -0,0 +1,37 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef CKPT_H_
+#define CKPT_H_
+
+#include "psys.h"
+
+/* checkpoint of the state of a set of particle systems, saved on exit and
+ * restored on startup, so that a restarted clock carries on with its flames
+ * instead of fading them in from nothing. The file is written under a
+ * temporary name and renamed into place, so that a crash mid-write never
+ * leaves a truncated checkpoint behind.
+ */
+bool ckpt_save(const char *fname, ParticleSystem *const *psys, int count);
+
+/* restore a checkpoint saved with the same number of systems, from the file
+ * mapped into memory. Systems whose saved state doesn't match (the other
+ * particle mode) are left as they are.
+ */
+bool ckpt_load(const char *fname, ParticleSystem *const *psys, int count);
+
+#endif	// CKPT_H_
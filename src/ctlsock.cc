@@ -0,0 +1,236 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include "ctlsock.h"
+#include "app.h"
+
+#define CTL_MAX_CLIENTS	8
+#define CTL_LINE_SIZE	256
+
+struct CtlClient {
+	int fd;			// -1 for a free slot
+	char line[CTL_LINE_SIZE];
+	int len;
+};
+
+static bool remove_stale(const char *path, const struct sockaddr_un *addr);
+static void accept_client();
+static void read_client(CtlClient *c);
+static void close_client(CtlClient *c);
+
+static int listen_fd = -1;
+static int ep_fd = -1;
+static char sock_path[sizeof ((struct sockaddr_un*)0)->sun_path];
+static CtlClient clients[CTL_MAX_CLIENTS];
+
+bool ctl_open(const char *path, int epfd)
+{
+	struct sockaddr_un addr;
+	if(strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "control socket path too long: %s\n", path);
+		return false;
+	}
+
+	if((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		perror("failed to create control socket");
+		return false;
+	}
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if(!remove_stale(path, &addr)) {
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	if(bind(listen_fd, (struct sockaddr*)&addr, sizeof addr) == -1 || listen(listen_fd, 4) == -1) {
+		fprintf(stderr, "failed to bind control socket %s: %s\n", path, strerror(errno));
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	strcpy(sock_path, path);
+
+	ep_fd = epfd;
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = listen_fd;
+	epoll_ctl(ep_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+	for(int i=0; i<CTL_MAX_CLIENTS; i++) {
+		clients[i].fd = -1;
+	}
+	return true;
+}
+
+/* a socket left behind by a previous run which didn't exit cleanly is
+ * removed, but only if nothing is listening on it any more. Anything else
+ * at the path is left alone.
+ */
+static bool remove_stale(const char *path, const struct sockaddr_un *addr)
+{
+	struct stat st;
+	if(lstat(path, &st) == -1) {
+		if(errno == ENOENT) return true;
+		fprintf(stderr, "failed to stat control socket %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	if(!S_ISSOCK(st.st_mode)) {
+		fprintf(stderr, "control socket path %s exists, and isn't a socket\n", path);
+		return false;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd == -1) {
+		perror("failed to create control socket");
+		return false;
+	}
+	int res = connect(fd, (const struct sockaddr*)addr, sizeof *addr);
+	int err = errno;
+	close(fd);
+
+	if(res == 0) {
+		fprintf(stderr, "control socket %s is in use by another process\n", path);
+		return false;
+	}
+	if(err != ECONNREFUSED) {
+		fprintf(stderr, "failed to check control socket %s: %s\n", path, strerror(err));
+		return false;
+	}
+
+	if(unlink(path) == -1) {
+		fprintf(stderr, "failed to remove stale control socket %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void ctl_close()
+{
+	if(listen_fd == -1) return;
+
+	for(int i=0; i<CTL_MAX_CLIENTS; i++) {
+		if(clients[i].fd != -1) {
+			close_client(clients + i);
+		}
+	}
+	close(listen_fd);
+	listen_fd = -1;
+	unlink(sock_path);
+}
+
+bool ctl_handle(int fd)
+{
+	if(fd == -1 || listen_fd == -1) return false;
+
+	if(fd == listen_fd) {
+		accept_client();
+		return true;
+	}
+	for(int i=0; i<CTL_MAX_CLIENTS; i++) {
+		if(clients[i].fd == fd) {
+			read_client(clients + i);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void accept_client()
+{
+	int fd;
+	while((fd = accept4(listen_fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+		CtlClient *c = 0;
+		for(int i=0; i<CTL_MAX_CLIENTS; i++) {
+			if(clients[i].fd == -1) {
+				c = clients + i;
+				break;
+			}
+		}
+		if(!c) {
+			close(fd);	// too many clients
+			continue;
+		}
+
+		c->fd = fd;
+		c->len = 0;
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		epoll_ctl(ep_fd, EPOLL_CTL_ADD, fd, &ev);
+	}
+}
+
+/* run every complete line received so far. Replies are short, so they're
+ * sent without waiting, and dropped if the client doesn't keep up.
+ */
+static void read_client(CtlClient *c)
+{
+	for(;;) {
+		int sz = read(c->fd, c->line + c->len, CTL_LINE_SIZE - 1 - c->len);
+		if(sz == 0 || (sz == -1 && errno != EAGAIN && errno != EINTR)) {
+			close_client(c);
+			return;
+		}
+		if(sz == -1) {
+			if(errno == EINTR) continue;
+			return;
+		}
+		c->len += sz;
+
+		char *start = c->line;
+		char *end;
+		while((end = (char*)memchr(start, '\n', c->len - (start - c->line)))) {
+			*end = 0;
+			if(end > start && end[-1] == '\r') {
+				end[-1] = 0;
+			}
+
+			char reply[CTL_LINE_SIZE];
+			app_command(start, reply, sizeof reply - 1);
+			strcat(reply, "\n");
+			send(c->fd, reply, strlen(reply), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+			start = end + 1;
+		}
+		c->len -= start - c->line;
+		memmove(c->line, start, c->len);
+
+		if(c->len >= CTL_LINE_SIZE - 1) {
+			close_client(c);	// a line too long to be a command
+			return;
+		}
+	}
+}
+
+static void close_client(CtlClient *c)
+{
+	epoll_ctl(ep_fd, EPOLL_CTL_DEL, c->fd, 0);
+	close(c->fd);
+	c->fd = -1;
+}
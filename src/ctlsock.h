@@ -0,0 +1,32 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef CTLSOCK_H_
+#define CTLSOCK_H_
+
+/* UNIX domain control socket. Clients send commands, one per line, and get a
+ * one line reply for each, from app_command. All sockets are non-blocking and
+ * registered with the epoll instance of the main loop, which hands them back
+ * to ctl_handle when they're readable.
+ */
+bool ctl_open(const char *path, int epfd);
+void ctl_close();
+
+// returns false if fd isn't one of the control sockets
+bool ctl_handle(int fd);
+
+#endif	// CTLSOCK_H_
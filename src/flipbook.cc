@@ -0,0 +1,363 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "opengl.h"
+#include "flipbook.h"
+#include "imgenc.h"
+
+#define ATLAS_COLS		8
+#define ATLAS_ROWS		((FLIP_FRAMES + ATLAS_COLS - 1) / ATLAS_COLS)
+#define MAX_FRAME_SIZE	512
+
+/* cache file layout, in native byte order: this header, then the atlas as
+ * a QOI image, with the rows in GL order (bottom row first)
+ */
+#define FLIP_MAGIC		"ACFLIP01"
+
+struct FlipHeader {
+	char magic[8];
+	unsigned int key;
+	int frame_width, frame_height;
+	float bmin[2], bmax[2];
+};
+
+static unsigned int next_pow2(unsigned int x);
+
+FlipBook::FlipBook()
+{
+	tex = 0;
+	tex_width = tex_height = 0;
+	frame_width = frame_height = 0;
+}
+
+FlipBook::~FlipBook()
+{
+	destroy();
+}
+
+void FlipBook::destroy()
+{
+	if(tex) {
+		glDeleteTextures(1, &tex);
+		tex = 0;
+	}
+	tex_width = tex_height = 0;
+}
+
+// texture for the atlas, with its pixels, or uninitialized if there are none
+bool FlipBook::create_texture(const unsigned char *pixels)
+{
+	int width = ATLAS_COLS * frame_width;
+	int height = ATLAS_ROWS * frame_height;
+
+	int max_size;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	tex_width = next_pow2(width);
+	tex_height = next_pow2(height);
+	if(tex_width > max_size || tex_height > max_size) {
+		fprintf(stderr, "flipbook atlas too large: %dx%d\n", width, height);
+		return false;
+	}
+
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width, tex_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	if(pixels) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+	return true;
+}
+
+bool FlipBook::create(const ParticleSystem *psys, const std::vector<PSysVertex> *frames)
+{
+	destroy();
+
+	// the frames cover everything drawn in any of them, with a texel to spare
+	bmin = Vec3(1e30, 1e30, 0);
+	bmax = Vec3(-1e30, -1e30, 0);
+	for(int i=0; i<FLIP_SIM_FRAMES; i++) {
+		for(size_t j=0; j<frames[i].size(); j++) {
+			const PSysVertex &v = frames[i][j];
+			if(v.pos.x - v.hsz < bmin.x) bmin.x = v.pos.x - v.hsz;
+			if(v.pos.x + v.hsz > bmax.x) bmax.x = v.pos.x + v.hsz;
+			if(v.pos.y - v.hsz < bmin.y) bmin.y = v.pos.y - v.hsz;
+			if(v.pos.y + v.hsz > bmax.y) bmax.y = v.pos.y + v.hsz;
+		}
+	}
+	if(bmin.x > bmax.x) {
+		bmin = bmax = Vec3(0, 0, 0);
+	}
+
+	float texel = 1.0f / FLIP_TEXELS;
+	bmin.x -= texel;
+	bmin.y -= texel;
+	frame_width = (int)ceil((bmax.x - bmin.x) * FLIP_TEXELS) + 1;
+	frame_height = (int)ceil((bmax.y - bmin.y) * FLIP_TEXELS) + 1;
+	if(frame_width > MAX_FRAME_SIZE) frame_width = MAX_FRAME_SIZE;
+	if(frame_height > MAX_FRAME_SIZE) frame_height = MAX_FRAME_SIZE;
+	bmax.x = bmin.x + frame_width * texel;
+	bmax.y = bmin.y + frame_height * texel;
+
+	if(!create_texture(0)) {
+		return false;
+	}
+
+	int prev_fbo;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+
+	unsigned int fbo;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "flipbook: incomplete framebuffer\n");
+		glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+		glDeleteFramebuffers(1, &fbo);
+		destroy();
+		return false;
+	}
+
+	glPushAttrib(GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT | GL_SCISSOR_BIT);
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(bmin.x, bmax.x, bmin.y, bmax.y, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	/* the particles are blended additively, so scaling their alpha scales
+	 * their contribution, which makes cross-fading two frames exact
+	 */
+	std::vector<PSysVertex> verts;
+	for(int i=0; i<FLIP_FRAMES; i++) {
+		glViewport(i % ATLAS_COLS * frame_width, i / ATLAS_COLS * frame_height,
+				frame_width, frame_height);
+
+		float w = i < FLIP_FADE ? (float)i / FLIP_FADE : 1.0f;
+		for(int j=0; j<2; j++) {
+			const std::vector<PSysVertex> &src = j ? frames[FLIP_FRAMES + i] : frames[i];
+			float sw = j ? 1.0f - w : w;
+			if(src.empty() || sw <= 0.0f || (j && i >= FLIP_FADE)) continue;
+
+			verts = src;
+			for(size_t k=0; k<verts.size(); k++) {
+				verts[k].alpha *= sw;
+			}
+			psys->draw_snapshot(&verts[0], verts.size());
+		}
+	}
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glPopAttrib();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+	glDeleteFramebuffers(1, &fbo);
+	return true;
+}
+
+bool FlipBook::load(const char *fname, unsigned int key)
+{
+	FILE *fp = fopen(fname, "rb");
+	if(!fp) {
+		return false;	// not cached yet, not an error
+	}
+
+	std::vector<unsigned char> data;
+	unsigned char buf[16384];
+	size_t sz;
+	while((sz = fread(buf, 1, sizeof buf, fp)) > 0) {
+		data.insert(data.end(), buf, buf + sz);
+	}
+	fclose(fp);
+
+	FlipHeader hdr;
+	if(data.size() < sizeof hdr) return false;
+	memcpy(&hdr, &data[0], sizeof hdr);
+	if(memcmp(hdr.magic, FLIP_MAGIC, 8) != 0 || hdr.key != key || hdr.frame_width <= 0 ||
+			hdr.frame_height <= 0 || hdr.frame_width > MAX_FRAME_SIZE ||
+			hdr.frame_height > MAX_FRAME_SIZE) {
+		return false;
+	}
+
+	std::vector<unsigned char> pixels;
+	int width, height;
+	if(!img_decode(&data[sizeof hdr], data.size() - sizeof hdr, &pixels, &width, &height) ||
+			width != ATLAS_COLS * hdr.frame_width || height != ATLAS_ROWS * hdr.frame_height) {
+		fprintf(stderr, "flipbook: invalid cache file: %s\n", fname);
+		return false;
+	}
+
+	destroy();
+	frame_width = hdr.frame_width;
+	frame_height = hdr.frame_height;
+	bmin = Vec3(hdr.bmin[0], hdr.bmin[1], 0);
+	bmax = Vec3(hdr.bmax[0], hdr.bmax[1], 0);
+	return create_texture(&pixels[0]);
+}
+
+// written under a temporary name and renamed into place, like checkpoints
+bool FlipBook::save(const char *fname, unsigned int key) const
+{
+	if(!tex) return false;
+
+	int width = ATLAS_COLS * frame_width;
+	int height = ATLAS_ROWS * frame_height;
+
+	std::vector<unsigned char> pixels(tex_width * tex_height * 4);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	// drop the padding up to the power of two size
+	for(int i=0; i<height; i++) {
+		memmove(&pixels[i * width * 4], &pixels[i * tex_width * 4], width * 4);
+	}
+
+	FlipHeader hdr;
+	memcpy(hdr.magic, FLIP_MAGIC, 8);
+	hdr.key = key;
+	hdr.frame_width = frame_width;
+	hdr.frame_height = frame_height;
+	hdr.bmin[0] = bmin.x;
+	hdr.bmin[1] = bmin.y;
+	hdr.bmax[0] = bmax.x;
+	hdr.bmax[1] = bmax.y;
+
+	std::vector<unsigned char> buf((unsigned char*)&hdr, (unsigned char*)&hdr + sizeof hdr);
+	if(!img_encode(&buf, &pixels[0], width, height, 32, IMG_FMT_QOI)) {
+		return false;
+	}
+
+	std::vector<char> tmpname(strlen(fname) + 5);
+	sprintf(&tmpname[0], "%s.tmp", fname);
+
+	FILE *fp = fopen(&tmpname[0], "wb");
+	if(!fp) {
+		return false;
+	}
+	bool ok = fwrite(&buf[0], 1, buf.size(), fp) == buf.size();
+	if(fclose(fp) != 0) ok = false;
+	if(!ok || rename(&tmpname[0], fname) == -1) {
+		fprintf(stderr, "failed to write flipbook cache: %s\n", fname);
+		remove(&tmpname[0]);
+		return false;
+	}
+	return true;
+}
+
+void FlipBook::draw(float t, const Vec3 &offs, float scale, float weight) const
+{
+	if(!tex || weight <= 0.0f) return;
+
+	float f = t * FLIP_FPS;
+	f -= floor(f / FLIP_FRAMES) * FLIP_FRAMES;
+	int frame = (int)f;
+	float frac = f - frame;
+	if(frame >= FLIP_FRAMES) frame = 0;
+
+	float x0 = offs.x + bmin.x * scale;
+	float y0 = offs.y + bmin.y * scale;
+	float x1 = offs.x + bmax.x * scale;
+	float y1 = offs.y + bmax.y * scale;
+	float du = (float)frame_width / tex_width;
+	float dv = (float)frame_height / tex_height;
+
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glBegin(GL_QUADS);
+	for(int i=0; i<2; i++) {
+		int idx = (frame + i) % FLIP_FRAMES;
+		float w = (i ? frac : 1.0f - frac) * weight;
+		float u = idx % ATLAS_COLS * du;
+		float v = idx / ATLAS_COLS * dv;
+
+		glColor4f(w, w, w, w);
+		glTexCoord2f(u, v); glVertex2f(x0, y0);
+		glTexCoord2f(u + du, v); glVertex2f(x1, y0);
+		glTexCoord2f(u + du, v + dv); glVertex2f(x1, y1);
+		glTexCoord2f(u, v + dv); glVertex2f(x0, y1);
+	}
+	glEnd();
+}
+
+void FlipBook::get_bounds(const Vec3 &offs, float scale, Vec3 *vmin, Vec3 *vmax) const
+{
+	*vmin = Vec3(offs.x + bmin.x * scale, offs.y + bmin.y * scale, 0);
+	*vmax = Vec3(offs.x + bmax.x * scale, offs.y + bmax.y * scale, 0);
+}
+
+// the frames hold the premultiplied sums of the particles, so they're just added up
+void FlipBook::begin_draw()
+{
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT);
+	glDisable(GL_LIGHTING);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+}
+
+void FlipBook::end_draw()
+{
+	glPopAttrib();
+}
+
+void flip_simulate(ParticleSystem *const *psys, int count, float warmup,
+		std::vector<PSysVertex> *frames)
+{
+	float dt = 1.0f / (FLIP_FPS * FLIP_SUBSTEPS);
+
+	int warmup_steps = (int)(warmup / dt + 0.5f);
+	for(int i=0; i<warmup_steps; i++) {
+		ParticleSystem::update_batch(psys, count, dt);
+	}
+
+	for(int i=0; i<FLIP_SIM_FRAMES; i++) {
+		for(int j=0; j<FLIP_SUBSTEPS; j++) {
+			ParticleSystem::update_batch(psys, count, dt);
+		}
+		for(int j=0; j<count; j++) {
+			std::vector<PSysVertex> *snap = frames + j * FLIP_SIM_FRAMES + i;
+			snap->clear();
+			psys[j]->snapshot(snap);
+		}
+	}
+}
+
+static unsigned int next_pow2(unsigned int x)
+{
+	--x;
+	x |= x >> 1;
+	x |= x >> 2;
+	x |= x >> 4;
+	x |= x >> 8;
+	x |= x >> 16;
+	return x + 1;
+}
@@ -0,0 +1,82 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef FLIPBOOK_H_
+#define FLIPBOOK_H_
+
+#include <vector>
+#include "psys.h"
+
+#define FLIP_FRAMES		32	// frames in the loop
+#define FLIP_FADE		8	// frames past the loop, cross-faded into its start
+#define FLIP_FPS		16
+#define FLIP_SUBSTEPS	4	// simulation steps per frame
+#define FLIP_TEXELS		128	// texels per unit of particle space
+
+#define FLIP_SIM_FRAMES	(FLIP_FRAMES + FLIP_FADE)
+
+/* a seamless loop of the flames of a single glyph, simulated in advance and
+ * kept as an atlas of frames in a texture, so that a clock can be drawn with
+ * next to no work per frame. The frames simulated past the end of the loop
+ * are cross-faded into its first frames, which hides the loop point. Frames
+ * add up like the particles do, and the two frames around the current time
+ * are blended together, to make up for the low frame rate.
+ */
+class FlipBook {
+private:
+	unsigned int tex;
+	int tex_width, tex_height;
+	int frame_width, frame_height;	// in texels
+	Vec3 bmin, bmax;				// area of the frames, in particle space
+
+	bool create_texture(const unsigned char *pixels);
+
+public:
+	FlipBook();
+	~FlipBook();
+
+	FlipBook(const FlipBook&) = delete;
+	FlipBook &operator =(const FlipBook&) = delete;
+
+	/* render the FLIP_SIM_FRAMES snapshots in frames into the atlas, with the
+	 * render state of psys. Needs framebuffer object support.
+	 */
+	bool create(const ParticleSystem *psys, const std::vector<PSysVertex> *frames);
+	void destroy();
+
+	// cache files, only loaded if they were saved with the same key
+	bool load(const char *fname, unsigned int key);
+	bool save(const char *fname, unsigned int key) const;
+
+	/* draw the frame at time t (in seconds, the loop repeats forever) scaled
+	 * by scale, then moved by offs, and with its brightness scaled by weight.
+	 * Call between begin_draw and end_draw.
+	 */
+	void draw(float t, const Vec3 &offs, float scale, float weight) const;
+	void get_bounds(const Vec3 &offs, float scale, Vec3 *vmin, Vec3 *vmax) const;
+
+	static void begin_draw();
+	static void end_draw();
+};
+
+/* run count systems together on the thread pool for warmup seconds, then
+ * take FLIP_SIM_FRAMES snapshots of each, into frames[i * FLIP_SIM_FRAMES]
+ */
+void flip_simulate(ParticleSystem *const *psys, int count, float warmup,
+		std::vector<PSysVertex> *frames);
+
+#endif	// FLIPBOOK_H_
@@ -65,23 +65,9 @@ void Image::destroy()
 	width = height = tex_width = tex_height = 0;
 }
 
-bool Image::save(const char *fname) const
+bool Image::save(const char *fname, int fmt) const
 {
-	FILE *fp = fopen(fname, "wb");
-	if(!fp) {
-		return false;
-	}
-
-	fprintf(fp, "P6\n%d %d\n255\n", width, height);
-	unsigned char *pptr = pixels;
-	for(int i=0; i<width * height; i++) {
-		fputc(pptr[0], fp);
-		fputc(pptr[1], fp);
-		fputc(pptr[2], fp);
-		pptr += bpp / 8;
-	}
-	fclose(fp);
-	return true;
+	return img_write(fname, pixels, width, height, bpp, fmt);
 }
 
 unsigned int Image::gen_texture()
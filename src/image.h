@@ -19,6 +19,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define IMAGE_H_
 
 #include "vec3.h"
+#include "imgenc.h"
 
 class Image {
 private:
@@ -37,7 +38,8 @@ public:
 	void create(int xsz, int ysz, unsigned char *pix = 0);
 	void destroy();
 
-	bool save(const char *fname) const;
+	// fmt is one of the IMG_FMT_* constants from imgenc.h
+	bool save(const char *fname, int fmt = IMG_FMT_AUTO) const;
 
 	unsigned int gen_texture();
 };
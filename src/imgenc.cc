@@ -0,0 +1,710 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include "imgenc.h"
+#include "tpool.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAX_ASYNC_PENDING	8
+
+static void encode_ppm(std::vector<unsigned char> *buf, const unsigned char *pixels,
+		int width, int height, int bpp, unsigned int flags);
+static void encode_qoi(std::vector<unsigned char> *buf, const unsigned char *pixels,
+		int width, int height, int bpp, unsigned int flags);
+static bool decode_qoi(const unsigned char *data, size_t size, std::vector<unsigned char> *pixels,
+		int *width, int *height);
+static void encode_png(std::vector<unsigned char> *buf, const unsigned char *pixels,
+		int width, int height, int bpp, unsigned int flags);
+
+static int num_async;
+static std::mutex async_lock;
+static std::condition_variable async_cond;
+
+int img_format_from_name(const char *fname)
+{
+	const char *suffix = strrchr(fname, '.');
+	if(suffix) {
+		if(strcasecmp(suffix, ".qoi") == 0) return IMG_FMT_QOI;
+		if(strcasecmp(suffix, ".png") == 0) return IMG_FMT_PNG;
+	}
+	return IMG_FMT_PPM;
+}
+
+void img_rgba_to_rgb(unsigned char *dest, const unsigned char *src, int npix)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	/* 4 pixels per iteration: pack four 32bit RGBA words into three 32bit
+	 * words of RGB triplets.
+	 */
+	int nblk = npix >> 2;
+	for(int i=0; i<nblk; i++) {
+		uint32_t p[4], w[3];
+		memcpy(p, src, sizeof p);
+		w[0] = (p[0] & 0xffffff) | (p[1] << 24);
+		w[1] = ((p[1] >> 8) & 0xffff) | (p[2] << 16);
+		w[2] = ((p[2] >> 16) & 0xff) | (p[3] << 8);
+		memcpy(dest, w, sizeof w);
+		src += 16;
+		dest += 12;
+	}
+	npix &= 3;
+#endif
+
+	for(int i=0; i<npix; i++) {
+		dest[0] = src[0];
+		dest[1] = src[1];
+		dest[2] = src[2];
+		src += 4;
+		dest += 3;
+	}
+}
+
+// x * a / 255 correctly rounded, without a division
+#define MUL255(x, a)	\
+	((((x) * (a) + 128) + (((x) * (a) + 128) >> 8)) >> 8)
+
+void img_premultiply(unsigned char *dest, const unsigned char *src, int npix)
+{
+#ifdef __SSE2__
+	// 4 pixels per iteration, in 16bit lanes
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rgb_mask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+	const __m128i alpha_one = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+	const __m128i half = _mm_set1_epi16(128);
+
+	int nblk = npix >> 2;
+	for(int i=0; i<nblk; i++) {
+		__m128i px = _mm_loadu_si128((const __m128i*)src);
+		__m128i lo = _mm_unpacklo_epi8(px, zero);
+		__m128i hi = _mm_unpackhi_epi8(px, zero);
+
+		// broadcast alpha to the color lanes, and multiply alpha by 255/255
+		__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+		__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+		alo = _mm_or_si128(_mm_and_si128(alo, rgb_mask), alpha_one);
+		ahi = _mm_or_si128(_mm_and_si128(ahi, rgb_mask), alpha_one);
+
+		lo = _mm_add_epi16(_mm_mullo_epi16(lo, alo), half);
+		hi = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), half);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		_mm_storeu_si128((__m128i*)dest, _mm_packus_epi16(lo, hi));
+		src += 16;
+		dest += 16;
+	}
+	npix &= 3;
+#endif
+
+	for(int i=0; i<npix; i++) {
+		unsigned int a = src[3];
+		dest[0] = MUL255(src[0], a);
+		dest[1] = MUL255(src[1], a);
+		dest[2] = MUL255(src[2], a);
+		dest[3] = a;
+		src += 4;
+		dest += 4;
+	}
+}
+
+bool img_encode(std::vector<unsigned char> *buf, const unsigned char *pixels,
+		int width, int height, int bpp, int fmt, unsigned int flags)
+{
+	if(!pixels || width <= 0 || height <= 0 || (bpp != 24 && bpp != 32)) {
+		return false;
+	}
+
+	switch(fmt) {
+	case IMG_FMT_PPM:
+		encode_ppm(buf, pixels, width, height, bpp, flags);
+		break;
+	case IMG_FMT_QOI:
+		encode_qoi(buf, pixels, width, height, bpp, flags);
+		break;
+	case IMG_FMT_PNG:
+		encode_png(buf, pixels, width, height, bpp, flags);
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+bool img_decode(const unsigned char *data, size_t size, std::vector<unsigned char> *pixels,
+		int *width, int *height)
+{
+	if(size >= 4 && memcmp(data, "qoif", 4) == 0) {
+		return decode_qoi(data, size, pixels, width, height);
+	}
+	return false;
+}
+
+bool img_write(const char *fname, const unsigned char *pixels, int width,
+		int height, int bpp, int fmt, unsigned int flags)
+{
+	if(fmt == IMG_FMT_AUTO) {
+		fmt = img_format_from_name(fname);
+	}
+
+	std::vector<unsigned char> buf;
+	if(!img_encode(&buf, pixels, width, height, bpp, fmt, flags)) {
+		return false;
+	}
+
+	FILE *fp = fopen(fname, "wb");
+	if(!fp) {
+		return false;
+	}
+	size_t wr = fwrite(&buf[0], 1, buf.size(), fp);
+	if(fclose(fp) == -1 || wr < buf.size()) {
+		return false;
+	}
+	return true;
+}
+
+bool img_write_async(const char *fname, unsigned char *pixels, int width,
+		int height, int bpp, int fmt, unsigned int flags)
+{
+	{
+		std::unique_lock<std::mutex> lock(async_lock);
+		if(num_async >= MAX_ASYNC_PENDING) {
+			delete [] pixels;
+			return false;
+		}
+		++num_async;
+	}
+
+	std::string name = fname;
+	get_thread_pool()->add_job([=]() {
+		if(!img_write(name.c_str(), pixels, width, height, bpp, fmt, flags)) {
+			fprintf(stderr, "failed to write image: %s\n", name.c_str());
+		}
+		delete [] pixels;
+
+		std::unique_lock<std::mutex> lock(async_lock);
+		if(--num_async == 0) {
+			async_cond.notify_all();
+		}
+	});
+	return true;
+}
+
+void img_write_wait()
+{
+	std::unique_lock<std::mutex> lock(async_lock);
+	while(num_async > 0) {
+		async_cond.wait(lock);
+	}
+}
+
+static inline const unsigned char *get_row(const unsigned char *pixels, int y,
+		int width, int height, int bpp, unsigned int flags)
+{
+	if(flags & IMG_FLIP_Y) {
+		y = height - y - 1;
+	}
+	return pixels + y * width * (bpp / 8);
+}
+
+static void put_be32(std::vector<unsigned char> *buf, uint32_t x)
+{
+	buf->push_back(x >> 24);
+	buf->push_back(x >> 16);
+	buf->push_back(x >> 8);
+	buf->push_back(x);
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// ---- PPM ----
+static void encode_ppm(std::vector<unsigned char> *buf, const unsigned char *pixels,
+		int width, int height, int bpp, unsigned int flags)
+{
+	char hdr[64];
+	int hdrlen = sprintf(hdr, "P6\n%d %d\n255\n", width, height);
+
+	size_t offs = buf->size();
+	buf->resize(offs + hdrlen + width * height * 3);
+	unsigned char *dest = &(*buf)[offs];
+
+	memcpy(dest, hdr, hdrlen);
+	dest += hdrlen;
+
+	std::vector<unsigned char> tmp;
+	if(bpp == 32) {
+		tmp.resize(width * 4);
+	}
+
+	for(int i=0; i<height; i++) {
+		const unsigned char *row = get_row(pixels, i, width, height, bpp, flags);
+		if(bpp == 32) {
+			img_premultiply(&tmp[0], row, width);
+			img_rgba_to_rgb(dest, &tmp[0], width);
+		} else {
+			memcpy(dest, row, width * 3);
+		}
+		dest += width * 3;
+	}
+}
+
+// ---- QOI (see https://qoiformat.org/qoi-specification.pdf) ----
+#define QOI_OP_INDEX	0x00
+#define QOI_OP_DIFF		0x40
+#define QOI_OP_LUMA		0x80
+#define QOI_OP_RUN		0xc0
+#define QOI_OP_RGB		0xfe
+#define QOI_OP_RGBA		0xff
+
+#define QOI_HASH(r, g, b, a)	(((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) & 63)
+
+static void encode_qoi(std::vector<unsigned char> *buf, const unsigned char *pixels,
+		int width, int height, int bpp, unsigned int flags)
+{
+	int nchan = bpp / 8;
+
+	buf->reserve(buf->size() + 22 + width * height * (nchan + 1) / 2);
+
+	buf->push_back('q');
+	buf->push_back('o');
+	buf->push_back('i');
+	buf->push_back('f');
+	put_be32(buf, width);
+	put_be32(buf, height);
+	buf->push_back(nchan);
+	buf->push_back(0);	// sRGB with linear alpha
+
+	unsigned char index[64][4];
+	memset(index, 0, sizeof index);
+
+	unsigned char prev[4] = {0, 0, 0, 255};
+	int run = 0;
+
+	for(int i=0; i<height; i++) {
+		const unsigned char *src = get_row(pixels, i, width, height, bpp, flags);
+
+		for(int j=0; j<width; j++) {
+			unsigned char r = src[0];
+			unsigned char g = src[1];
+			unsigned char b = src[2];
+			unsigned char a = nchan == 4 ? src[3] : 255;
+			src += nchan;
+
+			if(r == prev[0] && g == prev[1] && b == prev[2] && a == prev[3]) {
+				if(++run == 62) {
+					buf->push_back(QOI_OP_RUN | (run - 1));
+					run = 0;
+				}
+				continue;
+			}
+			if(run) {
+				buf->push_back(QOI_OP_RUN | (run - 1));
+				run = 0;
+			}
+
+			int hash = QOI_HASH(r, g, b, a);
+			unsigned char *ent = index[hash];
+			if(ent[0] == r && ent[1] == g && ent[2] == b && ent[3] == a) {
+				buf->push_back(QOI_OP_INDEX | hash);
+			} else {
+				ent[0] = r;
+				ent[1] = g;
+				ent[2] = b;
+				ent[3] = a;
+
+				if(a == prev[3]) {
+					signed char dr = r - prev[0];
+					signed char dg = g - prev[1];
+					signed char db = b - prev[2];
+					signed char dr_dg = dr - dg;
+					signed char db_dg = db - dg;
+
+					if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+						buf->push_back(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+					} else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+							db_dg >= -8 && db_dg <= 7) {
+						buf->push_back(QOI_OP_LUMA | (dg + 32));
+						buf->push_back((dr_dg + 8) << 4 | (db_dg + 8));
+					} else {
+						buf->push_back(QOI_OP_RGB);
+						buf->push_back(r);
+						buf->push_back(g);
+						buf->push_back(b);
+					}
+				} else {
+					buf->push_back(QOI_OP_RGBA);
+					buf->push_back(r);
+					buf->push_back(g);
+					buf->push_back(b);
+					buf->push_back(a);
+				}
+			}
+
+			prev[0] = r;
+			prev[1] = g;
+			prev[2] = b;
+			prev[3] = a;
+		}
+	}
+	if(run) {
+		buf->push_back(QOI_OP_RUN | (run - 1));
+	}
+
+	// end marker
+	for(int i=0; i<7; i++) {
+		buf->push_back(0);
+	}
+	buf->push_back(1);
+}
+
+static bool decode_qoi(const unsigned char *data, size_t size, std::vector<unsigned char> *pixels,
+		int *width, int *height)
+{
+	if(size < 14 + 8) return false;
+
+	uint32_t w = get_be32(data + 4);
+	uint32_t h = get_be32(data + 8);
+	if(!w || !h || w > 16384 || h > 16384 || (data[12] != 3 && data[12] != 4)) {
+		return false;
+	}
+
+	const unsigned char *src = data + 14;
+	const unsigned char *end = data + size - 8;	// end marker
+
+	pixels->resize(w * h * 4);
+	unsigned char *dest = &(*pixels)[0];
+	unsigned char *dest_end = dest + pixels->size();
+
+	unsigned char index[64][4];
+	memset(index, 0, sizeof index);
+	unsigned char px[4] = {0, 0, 0, 255};
+
+	while(dest < dest_end) {
+		if(src >= end) return false;
+
+		int op = *src++;
+		int run = 1;
+
+		if(op == QOI_OP_RGB || op == QOI_OP_RGBA) {
+			int nchan = op == QOI_OP_RGB ? 3 : 4;
+			if(end - src < nchan) return false;
+			memcpy(px, src, nchan);
+			src += nchan;
+		} else {
+			switch(op & 0xc0) {
+			case QOI_OP_INDEX:
+				memcpy(px, index[op], 4);
+				break;
+			case QOI_OP_DIFF:
+				px[0] += ((op >> 4) & 3) - 2;
+				px[1] += ((op >> 2) & 3) - 2;
+				px[2] += (op & 3) - 2;
+				break;
+			case QOI_OP_LUMA:
+				{
+					if(src >= end) return false;
+					int dg = (op & 0x3f) - 32;
+					int b2 = *src++;
+					px[0] += dg + ((b2 >> 4) & 0xf) - 8;
+					px[1] += dg;
+					px[2] += dg + (b2 & 0xf) - 8;
+				}
+				break;
+			case QOI_OP_RUN:
+				run = (op & 0x3f) + 1;
+				break;
+			}
+		}
+		memcpy(index[QOI_HASH(px[0], px[1], px[2], px[3])], px, 4);
+
+		while(run-- > 0 && dest < dest_end) {
+			memcpy(dest, px, 4);
+			dest += 4;
+		}
+	}
+
+	*width = w;
+	*height = h;
+	return true;
+}
+
+// ---- PNG, with a stored or a fast fixed-huffman deflate stream ----
+struct CRCTable {
+	uint32_t tab[256];
+
+	CRCTable()
+	{
+		for(int i=0; i<256; i++) {
+			uint32_t c = i;
+			for(int j=0; j<8; j++) {
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			}
+			tab[i] = c;
+		}
+	}
+};
+
+static uint32_t crc32(uint32_t crc, const unsigned char *data, size_t sz)
+{
+	static const CRCTable crctab;
+
+	crc = ~crc;
+	for(size_t i=0; i<sz; i++) {
+		crc = crctab.tab[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static uint32_t adler32(const unsigned char *data, size_t sz)
+{
+	uint32_t a = 1, b = 0;
+
+	while(sz > 0) {
+		// 5552 is the largest n such that the sums can't overflow before the modulo
+		size_t n = sz < 5552 ? sz : 5552;
+		sz -= n;
+		while(n-- > 0) {
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+struct BitWriter {
+	std::vector<unsigned char> *out;
+	uint32_t bits;
+	int nbits;
+};
+
+static inline void put_bits(BitWriter *bw, uint32_t val, int n)
+{
+	bw->bits |= val << bw->nbits;
+	bw->nbits += n;
+	while(bw->nbits >= 8) {
+		bw->out->push_back(bw->bits);
+		bw->bits >>= 8;
+		bw->nbits -= 8;
+	}
+}
+
+static inline void flush_bits(BitWriter *bw)
+{
+	if(bw->nbits > 0) {
+		bw->out->push_back(bw->bits);
+	}
+	bw->bits = 0;
+	bw->nbits = 0;
+}
+
+// huffman codes are packed starting from their most significant bit
+static inline void put_huff(BitWriter *bw, uint32_t code, int len)
+{
+	uint32_t rev = 0;
+	for(int i=0; i<len; i++) {
+		rev = (rev << 1) | (code & 1);
+		code >>= 1;
+	}
+	put_bits(bw, rev, len);
+}
+
+static inline void put_literal(BitWriter *bw, int lit)
+{
+	if(lit < 144) {
+		put_huff(bw, 0x30 + lit, 8);
+	} else if(lit < 256) {
+		put_huff(bw, 0x190 + lit - 144, 9);
+	} else if(lit < 280) {
+		put_huff(bw, lit - 256, 7);
+	} else {
+		put_huff(bw, 0xc0 + lit - 280, 8);
+	}
+}
+
+static const int len_base[] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+	67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const int len_extra[] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+	4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const int dist_base[] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+	769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const int dist_extra[] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8,
+	8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static inline void put_match(BitWriter *bw, int len, int dist)
+{
+	int i = 0;
+	while(i < 28 && len_base[i + 1] <= len) i++;
+	put_literal(bw, 257 + i);
+	if(len_extra[i]) {
+		put_bits(bw, len - len_base[i], len_extra[i]);
+	}
+
+	int j = 0;
+	while(j < 29 && dist_base[j + 1] <= dist) j++;
+	put_huff(bw, j, 5);
+	if(dist_extra[j]) {
+		put_bits(bw, dist - dist_base[j], dist_extra[j]);
+	}
+}
+
+#define DEFL_WIN_SIZE	32768
+#define DEFL_MAX_MATCH	258
+#define DEFL_HASH_BITS	15
+#define DEFL_HASH(p)	\
+	((((uint32_t)(p)[0] << 16 | (uint32_t)(p)[1] << 8 | (p)[2]) * 2654435761u) >> (32 - DEFL_HASH_BITS))
+
+/* single block, fixed huffman codes, greedy matching against the most recent
+ * occurence of each 3-byte hash. Fast and good enough for mostly empty frames.
+ */
+static void deflate_fast(std::vector<unsigned char> *out, const unsigned char *src, int size)
+{
+	BitWriter bw = {out, 0, 0};
+	std::vector<int> head(1 << DEFL_HASH_BITS, -1);
+
+	put_bits(&bw, 1, 1);	// BFINAL
+	put_bits(&bw, 1, 2);	// BTYPE: fixed huffman
+
+	int i = 0;
+	while(i < size) {
+		int match_len = 0, match_dist = 0;
+
+		if(i + 3 <= size) {
+			uint32_t h = DEFL_HASH(src + i);
+			int cand = head[h];
+			head[h] = i;
+
+			if(cand >= 0 && i - cand <= DEFL_WIN_SIZE) {
+				int maxlen = size - i < DEFL_MAX_MATCH ? size - i : DEFL_MAX_MATCH;
+				int len = 0;
+				while(len < maxlen && src[cand + len] == src[i + len]) len++;
+				if(len >= 3) {
+					match_len = len;
+					match_dist = i - cand;
+				}
+			}
+		}
+
+		if(match_len) {
+			put_match(&bw, match_len, match_dist);
+			int end = i + match_len;
+			while(++i < end && i + 3 <= size) {
+				head[DEFL_HASH(src + i)] = i;
+			}
+			i = end;
+		} else {
+			put_literal(&bw, src[i++]);
+		}
+	}
+
+	put_literal(&bw, 256);	// end of block
+	flush_bits(&bw);
+}
+
+static void deflate_stored(std::vector<unsigned char> *out, const unsigned char *src, int size)
+{
+	do {
+		int len = size > 65535 ? 65535 : size;
+		size -= len;
+
+		out->push_back(size > 0 ? 0 : 1);	// BFINAL, BTYPE: stored
+		out->push_back(len & 0xff);
+		out->push_back(len >> 8);
+		out->push_back(~len & 0xff);
+		out->push_back((~len >> 8) & 0xff);
+		out->insert(out->end(), src, src + len);
+		src += len;
+	} while(size > 0);
+}
+
+static void put_png_chunk(std::vector<unsigned char> *buf, const char *type,
+		const unsigned char *data, size_t sz)
+{
+	put_be32(buf, sz);
+	size_t offs = buf->size();
+	buf->insert(buf->end(), type, type + 4);
+	if(sz) {
+		buf->insert(buf->end(), data, data + sz);
+	}
+	put_be32(buf, crc32(0, &(*buf)[offs], sz + 4));
+}
+
+static void encode_png(std::vector<unsigned char> *buf, const unsigned char *pixels,
+		int width, int height, int bpp, unsigned int flags)
+{
+	static const unsigned char sig[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	buf->insert(buf->end(), sig, sig + sizeof sig);
+
+	unsigned char ihdr[13];
+	ihdr[0] = width >> 24;
+	ihdr[1] = width >> 16;
+	ihdr[2] = width >> 8;
+	ihdr[3] = width;
+	ihdr[4] = height >> 24;
+	ihdr[5] = height >> 16;
+	ihdr[6] = height >> 8;
+	ihdr[7] = height;
+	ihdr[8] = 8;					// bits per channel
+	ihdr[9] = bpp == 32 ? 6 : 2;	// color type: RGBA or RGB
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+	put_png_chunk(buf, "IHDR", ihdr, sizeof ihdr);
+
+	// raw scanlines, each prefixed with filter type 0 (none)
+	int pitch = width * (bpp / 8);
+	std::vector<unsigned char> raw((pitch + 1) * height);
+	unsigned char *dest = &raw[0];
+	for(int i=0; i<height; i++) {
+		*dest++ = 0;
+		memcpy(dest, get_row(pixels, i, width, height, bpp, flags), pitch);
+		dest += pitch;
+	}
+
+	std::vector<unsigned char> zdata;
+	zdata.reserve(raw.size() / 4 + 64);
+	zdata.push_back(0x78);	// deflate, 32k window
+	zdata.push_back(0x01);	// fastest compression, check bits
+	if(flags & IMG_PNG_STORED) {
+		deflate_stored(&zdata, &raw[0], raw.size());
+	} else {
+		deflate_fast(&zdata, &raw[0], raw.size());
+	}
+	put_be32(&zdata, adler32(&raw[0], raw.size()));
+
+	put_png_chunk(buf, "IDAT", &zdata[0], zdata.size());
+	put_png_chunk(buf, "IEND", 0, 0);
+}
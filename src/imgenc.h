@@ -0,0 +1,69 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef IMGENC_H_
+#define IMGENC_H_
+
+#include <vector>
+
+enum {
+	IMG_FMT_AUTO = -1,	// pick format from the filename suffix
+	IMG_FMT_PPM,
+	IMG_FMT_QOI,
+	IMG_FMT_PNG
+};
+
+// encoder flags
+enum {
+	IMG_FLIP_Y		= 1,	// pixels are bottom-up (as returned by glReadPixels)
+	IMG_PNG_STORED	= 2		// don't compress PNG data, just store it
+};
+
+int img_format_from_name(const char *fname);
+
+/* pixel conversion helpers, npix pixels of packed 32bit RGBA input.
+ * premultiply may operate in-place (dest == src).
+ */
+void img_rgba_to_rgb(unsigned char *dest, const unsigned char *src, int npix);
+void img_premultiply(unsigned char *dest, const unsigned char *src, int npix);
+
+/* encode the image in memory, appending to buf. bpp is 24 or 32.
+ * PPM has no alpha channel, so 32bpp images are composited over black.
+ */
+bool img_encode(std::vector<unsigned char> *buf, const unsigned char *pixels,
+		int width, int height, int bpp, int fmt, unsigned int flags = 0);
+
+/* decode an image in memory to 32bit RGBA pixels, top row first. Only QOI
+ * is supported, for reading back images this program wrote.
+ */
+bool img_decode(const unsigned char *data, size_t size, std::vector<unsigned char> *pixels,
+		int *width, int *height);
+
+// encode and write out the whole file with a single write
+bool img_write(const char *fname, const unsigned char *pixels, int width,
+		int height, int bpp, int fmt = IMG_FMT_AUTO, unsigned int flags = 0);
+
+/* encode and write on the global thread pool. Takes ownership of pixels,
+ * which must have been allocated with new []. Returns false (and frees the
+ * pixels) if too many frames are already queued, so the caller never blocks.
+ */
+bool img_write_async(const char *fname, unsigned char *pixels, int width,
+		int height, int bpp, int fmt = IMG_FMT_AUTO, unsigned int flags = 0);
+// wait for all pending asynchronous writes to complete
+void img_write_wait();
+
+#endif	// IMGENC_H_
@@ -18,65 +18,266 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/select.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <GL/gl.h>
 #include <GL/glx.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include "app.h"
+#include "record.h"
+#include "ctlsock.h"
 
 #define _NET_WM_STATE_REMOVE	0
 #define _NET_WM_STATE_ADD		1
 #define _NET_WM_STATE_TOGGLE	2
 
+#define DEF_OUTPUT_FPS	60
+
+// frames of damage to remember, for buffers this old
+#define DAMAGE_HIST		4
+
+struct GLWindow {
+	Window win;		// none when headless
+	GLXContext ctx;
+	EGLSurface surf;	// EGL backend
+	EGLContext ectx;
+	int x, y, width, height;
+	bool mapped, redraw_pending;
+	unsigned int evmask;
+
+	long long frame_interval;	// nsec between frames, 0: as fast as swapping allows
+	long long next_frame;
+
+	// presentation timing, all in nsec on CLOCK_MONOTONIC
+	long long swaps;		// buffer swaps issued
+	long long last_msc, last_sbc;	// sync counters when last seen, -1: not yet
+	long long last_present;	// time of the last completed swap, 0: unknown
+	long long refresh;		// between vertical blanks, 0: unknown
+
+	/* EGL backend: the regions drawn in the last few frames, newest first,
+	 * as x, y, width, height from the bottom left.
+	 */
+	int damage[DAMAGE_HIST][4];
+	int num_damage;		// valid entries, anything older is the whole window
+};
+
+struct OutputSpec {
+	int x, y, width, height;
+	int fps;
+};
+
 static void cleanup();
-static bool create_glwin(int xsz, int ysz);
+static XVisualInfo *choose_visual();
+static bool init_egl();
+static XVisualInfo *choose_egl_config();
+static bool create_glwin(GLWindow *w, const OutputSpec *spec, const GLWindow *share);
+static void destroy_glwin(GLWindow *w);
+static GLWindow *find_window(Window xwin);
+static void make_current(GLWindow *w);
+static void set_swap_interval(GLWindow *w, int interval);
+static void begin_frame(GLWindow *w);
+static void end_frame(GLWindow *w);
+static void damage_union(const GLWindow *w, int count, int *rect);
 static bool handle_event(XEvent *ev);
-static void set_window_title(const char *title);
+static bool init_reactor();
+static void close_reactor();
+static void watch_fd(int fd);
+static void arm_tick();
+static void wait_for_events(long long nsec);	// nsec < 0: no timeout
+static void init_present_timing();
+static long long predict_present(GLWindow *w, long long now);
+static bool present_exact(const GLWindow *w);
+static void swap_complete(GLWindow *w, long long t, long long msc, long long sbc);
+static long long get_nsec();
+static void set_window_title(Window win, const char *title);
 static void set_no_decoration(Window win);
 static void set_fullscreen_state(Window win, int op);
+static bool parse_output(const char *str, OutputSpec *spec);
 static bool parse_args(int argc, char **argv);
 
 static int win_x = -1, win_y = -1;
 static int win_width = 800, win_height = 400;
-static bool fullscreen, quit, redraw_pending;
+static bool fullscreen, quit;
 static Display *dpy;
-static Window win, root_win;
-static GLXContext ctx;
+static Window root_win;
 static Atom xa_wm_proto, xa_del_window;
 static Atom xa_net_wm_state, xa_net_wm_state_fullscr;
-static unsigned int evmask;
+static XVisualInfo *vis_info;	// chosen once, for all windows
+static const char *rec_fname;
+static int rec_fps = 60;
+static const char *ctl_path;
+
+/* everything the main loop waits for goes through one epoll instance: the X
+ * connection, termination signals, a timer on the wall clock seconds, a timer
+ * for pacing the frames, and the control sockets
+ */
+static int epfd = -1;
+static int sig_fd = -1, tick_fd = -1, frame_fd = -1;
+
+/* EGL backend, instead of GLX. Headless runs on pbuffers, without an X
+ * connection at all.
+ */
+static bool use_egl, headless;
+static EGLDisplay edpy = EGL_NO_DISPLAY;
+static EGLConfig ecfg;
+static PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC egl_swap_damage;
+static PFNEGLSETDAMAGEREGIONKHRPROC egl_set_damage;
+static bool egl_buffer_age;
+
+/* presentation timing: GLX_OML_sync_control tells us when the last vertical
+ * blank happened, and how many of our swaps completed so far, which is
+ * enough to predict when the next frame will be shown. GLX_INTEL_swap_event
+ * sends an event with the exact time of every completed swap. Their UST
+ * timestamps are taken to be microseconds on CLOCK_MONOTONIC, like Mesa's.
+ */
+static PFNGLXGETSYNCVALUESOMLPROC glx_get_sync_values;
+static PFNGLXGETMSCRATEOMLPROC glx_get_msc_rate;
+static int glx_swap_event_base = -1;
+
+static OutputSpec out_spec[MAX_OUTPUTS];
+static int num_out_spec;
+
+static GLWindow windows[MAX_OUTPUTS];
+static int num_windows;
+static GLWindow *cur_win;	// window which received the last input event
+static GLWindow *ctx_win;	// window with the current context
 
 int main(int argc, char **argv)
 {
+	app_startup_mark("start");
+
 	if(!parse_args(argc, argv)) {
 		return 1;
 	}
-	if(!(dpy = XOpenDisplay(0))) {
-		fprintf(stderr, "failed to connect to the X server.\n");
+	if(rec_fname && !rec_open(rec_fname, rec_fps)) {
 		return 1;
 	}
-	xa_wm_proto = XInternAtom(dpy, "WM_PROTOCOLS", False);
-	xa_del_window = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
-	xa_net_wm_state = XInternAtom(dpy, "_NET_WM_STATE", False);
-	xa_net_wm_state_fullscr = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
 
-	if(!create_glwin(win_width, win_height)) {
+	/* quit cleanly on termination signals, which gives the app a chance to
+	 * save its state. They're blocked before any threads are started, and
+	 * read from a signalfd by the main loop.
+	 */
+	if(!init_reactor()) {
+		return 1;
+	}
+	if(ctl_path && !ctl_open(ctl_path, epfd)) {
+		close_reactor();
+		return 1;
+	}
+
+	// resources load in the background, while we're setting up X and GLX
+	if(!app_preload()) {
 		cleanup();
 		return 1;
 	}
-	if(win_x != -1) {
-		XMoveWindow(dpy, win, win_x, win_y);
+
+	if(!headless) {
+		if(!(dpy = XOpenDisplay(0))) {
+			fprintf(stderr, "failed to connect to the X server.\n");
+			cleanup();
+			return 1;
+		}
+		app_startup_mark("X connected");
+
+		// all atoms we need in a single round trip
+		static char *atom_names[] = {
+			(char*)"WM_PROTOCOLS", (char*)"WM_DELETE_WINDOW", (char*)"_NET_WM_STATE",
+			(char*)"_NET_WM_STATE_FULLSCREEN"
+		};
+		Atom atoms[4];
+		XInternAtoms(dpy, atom_names, 4, False, atoms);
+		xa_wm_proto = atoms[0];
+		xa_del_window = atoms[1];
+		xa_net_wm_state = atoms[2];
+		xa_net_wm_state_fullscr = atoms[3];
+
+		watch_fd(ConnectionNumber(dpy));
+	}
+
+	if(use_egl) {
+		if(!init_egl()) {
+			cleanup();
+			return 1;
+		}
+		app_startup_mark("EGL initialized");
+	}
+
+	if(!num_out_spec) {
+		OutputSpec *spec = out_spec + num_out_spec++;
+		spec->x = win_x;
+		spec->y = win_y;
+		spec->width = win_width;
+		spec->height = win_height;
+		spec->fps = 0;
+	}
+
+	/* one window per output, all contexts in the same share group, so that
+	 * textures are loaded once, and shared between all windows
+	 */
+	for(int i=0; i<num_out_spec; i++) {
+		if(!create_glwin(windows + num_windows, out_spec + i, i > 0 ? windows : 0)) {
+			cleanup();
+			return 1;
+		}
+		num_windows++;
+	}
+	cur_win = windows;
+	app_startup_mark("windows created");
+
+	/* with more than one window, waiting for vsync in each swap would divide
+	 * the framerate by the number of windows, so pace each window ourselves
+	 */
+	if(num_windows > 1) {
+		for(int i=0; i<num_windows; i++) {
+			make_current(windows + i);
+			set_swap_interval(windows + i, 0);
+		}
 	}
+	make_current(windows);
+	init_present_timing();
 
+	opt.num_outputs = num_windows;
 	if(!app_init()) {
 		cleanup();
 		return 1;
 	}
+	app_startup_mark("initialized");
+	bool first_frame = true;
 
 	for(;;) {
-		while(XPending(dpy) || !redraw_pending) {
+		bool redraw_pending;
+		for(;;) {
+			if(quit) {
+				goto break_main_loop;
+			}
+
+			redraw_pending = false;
+			for(int i=0; i<num_windows; i++) {
+				if(windows[i].redraw_pending) {
+					redraw_pending = true;
+					break;
+				}
+			}
+
+			if(!dpy || !XPending(dpy)) {
+				/* no X events queued: block in epoll instead of XNextEvent, so
+				 * that signals, ticks and control requests wake us up too. If
+				 * there's drawing to do, just handle whatever already arrived.
+				 */
+				wait_for_events(redraw_pending ? 0 : -1);
+				if(redraw_pending && !quit) break;
+				continue;
+			}
+
 			XEvent ev;
 			XNextEvent(dpy, &ev);
 			if(!handle_event(&ev) || quit) {
@@ -84,9 +285,60 @@ int main(int argc, char **argv)
 			}
 		}
 
-		if(redraw_pending) {
-			app_draw();
-			glXSwapBuffers(dpy, win);
+		// wait until the first window is due for its next frame
+		long long now = get_nsec();
+		long long next_frame = LLONG_MAX;
+		for(int i=0; i<num_windows; i++) {
+			GLWindow *w = windows + i;
+			if(w->redraw_pending && w->next_frame < next_frame) {
+				next_frame = w->next_frame;
+			}
+		}
+		if(next_frame > now) {
+			wait_for_events(next_frame - now);
+			continue;
+		}
+
+		/* simulate once, up to when the frame of the first output which is
+		 * due is expected to show up on screen, then draw on every output
+		 * which is due for a frame
+		 */
+		long long present = 0, interval = 0;
+		for(int i=0; i<num_windows; i++) {
+			GLWindow *w = windows + i;
+			if(w->redraw_pending && w->next_frame <= now) {
+				present = predict_present(w, now);
+				interval = w->frame_interval ? w->frame_interval : w->refresh;
+				break;
+			}
+		}
+		app_update(present, interval);
+
+		for(int i=0; i<num_windows; i++) {
+			GLWindow *w = windows + i;
+			if(!w->redraw_pending || w->next_frame > now) {
+				continue;
+			}
+
+			make_current(w);
+			begin_frame(w);
+			app_draw(i);
+			if(i == 0 && rec_active()) {
+				rec_frame(w->width, w->height);
+			}
+			end_frame(w);
+
+			if(first_frame) {
+				app_startup_done();
+				first_frame = false;
+			}
+
+			if(w->frame_interval) {
+				w->next_frame += w->frame_interval;
+				if(w->next_frame <= now) {
+					w->next_frame = now + w->frame_interval;
+				}
+			}
 		}
 	}
 break_main_loop:
@@ -102,38 +354,66 @@ void app_quit()
 
 void app_redisplay()
 {
-	redraw_pending = true;
+	for(int i=0; i<num_windows; i++) {
+		if(windows[i].mapped) {
+			windows[i].redraw_pending = true;
+		}
+	}
 }
 
 void app_fullscreen()
 {
-	set_fullscreen_state(win, _NET_WM_STATE_ADD);
+	set_fullscreen_state(cur_win->win, _NET_WM_STATE_ADD);
 }
 
 void app_windowed()
 {
-	set_fullscreen_state(win, _NET_WM_STATE_REMOVE);
+	set_fullscreen_state(cur_win->win, _NET_WM_STATE_REMOVE);
 }
 
 void app_fullscreen_toggle()
 {
-	set_fullscreen_state(win, _NET_WM_STATE_TOGGLE);
+	set_fullscreen_state(cur_win->win, _NET_WM_STATE_TOGGLE);
 }
 
 static void cleanup()
 {
-	if(!dpy) return;
-	if(ctx) {
+	ctl_close();
+	close_reactor();
+
+	if(!dpy && edpy == EGL_NO_DISPLAY) return;
+	if(num_windows > 0 && (windows[0].ctx || windows[0].ectx)) {
+		make_current(windows);
+		rec_close();
+		app_cleanup();
+	}
+	if(use_egl) {
+		eglMakeCurrent(edpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	} else {
 		glXMakeCurrent(dpy, 0, 0);
-		glXDestroyContext(dpy, ctx);
 	}
-	if(win) {
-		XDestroyWindow(dpy, win);
+	for(int i=0; i<num_windows; i++) {
+		destroy_glwin(windows + i);
+	}
+	num_windows = 0;
+	if(vis_info) {
+		XFree(vis_info);
+		vis_info = 0;
+	}
+	if(edpy != EGL_NO_DISPLAY) {
+		eglTerminate(edpy);
+		edpy = EGL_NO_DISPLAY;
+	}
+	if(dpy) {
+		XCloseDisplay(dpy);
+		dpy = 0;
 	}
-	XCloseDisplay(dpy);
 }
 
-static bool create_glwin(int xsz, int ysz)
+/* find an RGBA visual with depth 32, for the window to be composited with
+ * alpha. The same visual is used for every window, so this only runs once.
+ */
+static XVisualInfo *choose_visual()
 {
 	static int glx_attr[] = {
 		GLX_RENDER_TYPE, GLX_RGBA_BIT,
@@ -146,35 +426,33 @@ static bool create_glwin(int xsz, int ysz)
 	};
 
 	int scr = DefaultScreen(dpy);
-	root_win = RootWindow(dpy, scr);
-
 	GLXFBConfig *fb_configs, *fbcfg = 0;
-	XVisualInfo *vis_info;
+	XVisualInfo *vi;
 	int num_fb_configs;
 	if(!(fb_configs = glXChooseFBConfig(dpy, scr, glx_attr, &num_fb_configs))) {
 		fprintf(stderr, "failed to find matching GLX fbconfig\n");
-		return false;
+		return 0;
 	}
 
 	/* search for an fbconfig with depth 32 */
 	for(int i=0; i<num_fb_configs; i++) {
-		vis_info = glXGetVisualFromFBConfig(dpy, fb_configs[i]);
-		if(!vis_info) {
+		vi = glXGetVisualFromFBConfig(dpy, fb_configs[i]);
+		if(!vi) {
 			fprintf(stderr, "failed to get visual from fbconfig\n");
 			XFree(fb_configs);
-			return false;
+			return 0;
 		}
 
-		if(vis_info->depth == 32) {
+		if(vi->depth == 32) {
 			fbcfg = fb_configs + i;
 			break;
 		}
-		XFree(vis_info);
+		XFree(vi);
 	}
 	if(!fbcfg) {
 		fprintf(stderr, "failed to find 32bpp visual\n");
 		XFree(fb_configs);
-		return false;
+		return 0;
 	}
 
 	int rsize, gsize, bsize, asize, zsize, ssize;
@@ -184,13 +462,177 @@ static bool create_glwin(int xsz, int ysz)
 	glXGetFBConfigAttrib(dpy, *fbcfg, GLX_ALPHA_SIZE, &asize);
 	glXGetFBConfigAttrib(dpy, *fbcfg, GLX_DEPTH_SIZE, &zsize);
 	glXGetFBConfigAttrib(dpy, *fbcfg, GLX_STENCIL_SIZE, &ssize);
-	printf("got visual %lu: %d bpp (%d%d%d%d), %d zbuffer, %d stencil\n", vis_info->visualid,
+	printf("got visual %lu: %d bpp (%d%d%d%d), %d zbuffer, %d stencil\n", vi->visualid,
 			rsize + gsize + bsize + asize, rsize, gsize, bsize, asize, zsize, ssize);
 
-	if(!(ctx = glXCreateContext(dpy, vis_info, 0, True))) {
+	XFree(fb_configs);
+	return vi;
+}
+
+static bool init_egl()
+{
+	if(headless) {
+		/* Mesa's surfaceless platform doesn't need any window system at all,
+		 * otherwise hope that the default display can do pbuffers
+		 */
+		const char *client_ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+		if(client_ext && strstr(client_ext, "EGL_MESA_platform_surfaceless")) {
+			PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+				eglGetProcAddress("eglGetPlatformDisplayEXT");
+			if(get_platform_display) {
+				edpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+			}
+		}
+		if(edpy == EGL_NO_DISPLAY) {
+			edpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		}
+	} else {
+		edpy = eglGetDisplay((EGLNativeDisplayType)dpy);
+	}
+
+	if(edpy == EGL_NO_DISPLAY || !eglInitialize(edpy, 0, 0)) {
+		fprintf(stderr, "failed to initialize EGL\n");
+		edpy = EGL_NO_DISPLAY;
+		return false;
+	}
+	if(!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "EGL implementation doesn't support desktop OpenGL\n");
+		return false;
+	}
+
+	const char *ext = eglQueryString(edpy, EGL_EXTENSIONS);
+	if(!ext) ext = "";
+
+	/* partial update tells the driver which part we're about to draw, before
+	 * drawing. Swapping with damage tells the compositor which part changed.
+	 */
+	if(strstr(ext, "EGL_KHR_partial_update")) {
+		egl_set_damage = (PFNEGLSETDAMAGEREGIONKHRPROC)eglGetProcAddress("eglSetDamageRegionKHR");
+	}
+	if(strstr(ext, "EGL_KHR_swap_buffers_with_damage")) {
+		egl_swap_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+			eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	} else if(strstr(ext, "EGL_EXT_swap_buffers_with_damage")) {
+		egl_swap_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+			eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+	}
+	egl_buffer_age = egl_set_damage || strstr(ext, "EGL_EXT_buffer_age");
+
+	if(headless) {
+		static const EGLint cfg_attr[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_RED_SIZE, 8,
+			EGL_GREEN_SIZE, 8,
+			EGL_BLUE_SIZE, 8,
+			EGL_ALPHA_SIZE, 8,
+			EGL_NONE
+		};
+		EGLint num_cfg;
+		if(!eglChooseConfig(edpy, cfg_attr, &ecfg, 1, &num_cfg) || num_cfg < 1) {
+			fprintf(stderr, "failed to find an EGL pbuffer config\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+/* EGL counterpart of choose_visual: an RGBA config for windows, which maps to
+ * a depth 32 visual
+ */
+static XVisualInfo *choose_egl_config()
+{
+	static const EGLint cfg_attr[] = {
+		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_NONE
+	};
+
+	EGLint num_cfg;
+	if(!eglChooseConfig(edpy, cfg_attr, 0, 0, &num_cfg) || num_cfg < 1) {
+		fprintf(stderr, "failed to find matching EGL config\n");
+		return 0;
+	}
+	EGLConfig *configs = new EGLConfig[num_cfg];
+	eglChooseConfig(edpy, cfg_attr, configs, num_cfg, &num_cfg);
+
+	XVisualInfo *vi = 0;
+	for(int i=0; i<num_cfg; i++) {
+		EGLint vid;
+		if(!eglGetConfigAttrib(edpy, configs[i], EGL_NATIVE_VISUAL_ID, &vid) || !vid) {
+			continue;
+		}
+
+		XVisualInfo vinfo;
+		int num_vis;
+		vinfo.visualid = vid;
+		if(!(vi = XGetVisualInfo(dpy, VisualIDMask, &vinfo, &num_vis))) {
+			continue;
+		}
+		if(vi->depth == 32) {
+			ecfg = configs[i];
+			break;
+		}
+		XFree(vi);
+		vi = 0;
+	}
+	delete [] configs;
+
+	if(!vi) {
+		fprintf(stderr, "failed to find 32bpp visual\n");
+		return 0;
+	}
+
+	printf("got visual %lu (EGL), damage: %s%s%s\n", vi->visualid,
+			egl_swap_damage ? "swap" : "none", egl_set_damage ? ", partial update" : "",
+			egl_buffer_age ? ", buffer age" : "");
+	return vi;
+}
+
+static bool create_glwin(GLWindow *w, const OutputSpec *spec, const GLWindow *share)
+{
+	w->num_damage = 0;
+
+	if(headless) {
+		EGLint pbuf_attr[] = {EGL_WIDTH, spec->width, EGL_HEIGHT, spec->height, EGL_NONE};
+		if(!(w->surf = eglCreatePbufferSurface(edpy, ecfg, pbuf_attr))) {
+			fprintf(stderr, "failed to create %dx%d pbuffer\n", spec->width, spec->height);
+			return false;
+		}
+		if(!(w->ectx = eglCreateContext(edpy, ecfg, share ? share->ectx : EGL_NO_CONTEXT, 0))) {
+			fprintf(stderr, "failed to create OpenGL context\n");
+			return false;
+		}
+		w->x = w->y = 0;
+		w->mapped = w->redraw_pending = true;
+		w->frame_interval = spec->fps > 0 ? 1000000000LL / spec->fps : 0;
+		w->next_frame = 0;
+
+		make_current(w);
+		w->width = spec->width;
+		w->height = spec->height;
+		app_reshape(w - windows, w->width, w->height);
+		return true;
+	}
+
+	int scr = DefaultScreen(dpy);
+	root_win = RootWindow(dpy, scr);
+
+	if(!vis_info && !(vis_info = use_egl ? choose_egl_config() : choose_visual())) {
+		return false;
+	}
+
+	if(use_egl) {
+		w->ectx = eglCreateContext(edpy, ecfg, share ? share->ectx : EGL_NO_CONTEXT, 0);
+	} else {
+		w->ctx = glXCreateContext(dpy, vis_info, share ? share->ctx : 0, True);
+	}
+	if(!w->ctx && !w->ectx) {
 		fprintf(stderr, "failed to create OpenGL context\n");
-		XFree(vis_info);
-		XFree(fb_configs);
 		return false;
 	}
 
@@ -199,36 +641,225 @@ static bool create_glwin(int xsz, int ysz)
 	xattr.colormap = XCreateColormap(dpy, root_win, vis_info->visual, AllocNone);
 	unsigned int xattr_mask = CWColormap | CWBorderPixel | CWBackPixel;
 
-	win = XCreateWindow(dpy, root_win, 0, 0, xsz, ysz, 0, vis_info->depth, InputOutput,
+	int xsz = spec->width;
+	int ysz = spec->height;
+	w->win = XCreateWindow(dpy, root_win, 0, 0, xsz, ysz, 0, vis_info->depth, InputOutput,
 			vis_info->visual, xattr_mask, &xattr);
-	if(!win) {
+	if(!w->win) {
 		fprintf(stderr, "failed to create window\n");
-		XFree(vis_info);
-		XFree(fb_configs);
 		return false;
 	}
-	XFree(vis_info);
-	XFree(fb_configs);
-	evmask = ExposureMask | KeyPressMask | KeyReleaseMask | StructureNotifyMask | ButtonPressMask | Button1MotionMask;
-	XSelectInput(dpy, win, evmask);
-	XMapWindow(dpy, win);
+	if(use_egl && !(w->surf = eglCreateWindowSurface(edpy, ecfg, (EGLNativeWindowType)w->win, 0))) {
+		fprintf(stderr, "failed to create EGL window surface\n");
+		return false;
+	}
+	w->evmask = ExposureMask | KeyPressMask | KeyReleaseMask | StructureNotifyMask |
+		ButtonPressMask | ButtonReleaseMask | PointerMotionMask | LeaveWindowMask;
+	XSelectInput(dpy, w->win, w->evmask);
+	XMapWindow(dpy, w->win);
 
-	XSetWMProtocols(dpy, win, &xa_del_window, 1);
-	set_window_title("alphaclock");
+	XSetWMProtocols(dpy, w->win, &xa_del_window, 1);
+	set_window_title(w->win, "alphaclock");
 	if(fullscreen) {
-		set_fullscreen_state(win, _NET_WM_STATE_ADD);
+		set_fullscreen_state(w->win, _NET_WM_STATE_ADD);
 	} else {
-		set_no_decoration(win);
+		set_no_decoration(w->win);
+	}
+
+	w->x = spec->x;
+	w->y = spec->y;
+	if(w->x != -1) {
+		XMoveWindow(dpy, w->win, w->x, w->y);
 	}
 
-	glXMakeCurrent(dpy, win, ctx);
+	w->mapped = w->redraw_pending = false;
+	w->frame_interval = spec->fps > 0 ? 1000000000LL / spec->fps : 0;
+	if(!w->frame_interval && num_out_spec > 1) {
+		w->frame_interval = 1000000000LL / DEF_OUTPUT_FPS;
+	}
+	w->next_frame = 0;
+
+	make_current(w);
 
-	win_width = xsz;
-	win_height = ysz;
-	app_reshape(win_width, win_height);
+	w->width = xsz;
+	w->height = ysz;
+	app_reshape(w - windows, w->width, w->height);
 	return true;
 }
 
+static void destroy_glwin(GLWindow *w)
+{
+	if(w->ctx) {
+		glXDestroyContext(dpy, w->ctx);
+		w->ctx = 0;
+	}
+	if(w->ectx) {
+		eglDestroyContext(edpy, w->ectx);
+		w->ectx = 0;
+	}
+	if(w->surf) {
+		eglDestroySurface(edpy, w->surf);
+		w->surf = 0;
+	}
+	if(w->win) {
+		XDestroyWindow(dpy, w->win);
+		w->win = 0;
+	}
+	if(ctx_win == w) {
+		ctx_win = 0;
+	}
+}
+
+static GLWindow *find_window(Window xwin)
+{
+	for(int i=0; i<num_windows; i++) {
+		if(windows[i].win == xwin) {
+			return windows + i;
+		}
+	}
+	return 0;
+}
+
+static void make_current(GLWindow *w)
+{
+	if(ctx_win != w) {
+		if(use_egl) {
+			eglMakeCurrent(edpy, w->surf, w->surf, w->ectx);
+		} else {
+			glXMakeCurrent(dpy, w->win, w->ctx);
+		}
+		ctx_win = w;
+	}
+}
+
+static void set_swap_interval(GLWindow *w, int interval)
+{
+	typedef void (*swap_interval_ext_func)(Display*, GLXDrawable, int);
+	typedef int (*swap_interval_mesa_func)(unsigned int);
+
+	if(use_egl) {
+		eglSwapInterval(edpy, interval);	// applies to the current surface
+		return;
+	}
+
+	const char *ext = glXQueryExtensionsString(dpy, DefaultScreen(dpy));
+	if(!ext) return;
+
+	if(strstr(ext, "GLX_EXT_swap_control")) {
+		swap_interval_ext_func func = (swap_interval_ext_func)
+			glXGetProcAddress((const GLubyte*)"glXSwapIntervalEXT");
+		if(func) {
+			func(dpy, w->win, interval);
+			return;
+		}
+	}
+	if(strstr(ext, "GLX_MESA_swap_control")) {
+		swap_interval_mesa_func func = (swap_interval_mesa_func)
+			glXGetProcAddress((const GLubyte*)"glXSwapIntervalMESA");
+		if(func) {
+			func(interval);	// applies to the current drawable
+		}
+	}
+}
+
+/* EGL backend: record the region app_draw is about to touch, and when we
+ * know what's left in the back buffer, only repaint what changed since then
+ */
+static void begin_frame(GLWindow *w)
+{
+	if(!use_egl) return;
+
+	memmove(w->damage + 1, w->damage, (DAMAGE_HIST - 1) * sizeof *w->damage);
+	w->damage[0][0] = w->damage[0][1] = w->damage[0][2] = w->damage[0][3] = 0;
+	app_damage(w - windows, w->damage[0]);
+	if(w->num_damage < DAMAGE_HIST) {
+		w->num_damage++;
+	}
+
+	if(!egl_buffer_age) return;
+
+	// the back buffer holds the frame from age swaps ago, or garbage if age is 0
+	EGLint age = 0;
+	eglQuerySurface(edpy, w->surf, EGL_BUFFER_AGE_EXT, &age);
+
+	int region[4];
+	damage_union(w, age > 0 ? age + 1 : DAMAGE_HIST + 1, region);
+
+	if(egl_set_damage) {
+		egl_set_damage(edpy, w->surf, region, 1);
+	}
+	glScissor(region[0], region[1], region[2], region[3]);
+	glEnable(GL_SCISSOR_TEST);
+}
+
+static void end_frame(GLWindow *w)
+{
+	if(!use_egl) {
+		glXSwapBuffers(dpy, w->win);
+	} else {
+		glDisable(GL_SCISSOR_TEST);
+
+		if(egl_swap_damage) {
+			// whatever the flames covered in this frame or the previous one
+			int rect[4];
+			damage_union(w, 2, rect);
+			if(rect[2] <= 0 || rect[3] <= 0) {
+				rect[0] = rect[1] = 0;
+				rect[2] = rect[3] = 1;	// no rectangles would mean all of it
+			}
+			egl_swap_damage(edpy, w->surf, rect, 1);
+		} else {
+			eglSwapBuffers(edpy, w->surf);
+		}
+	}
+	w->swaps++;
+
+	/* without the sync extensions, the swap returning is the best guess for
+	 * when the frame was shown, and any whole frame intervals it's late by
+	 * were missed
+	 */
+	if(!present_exact(w)) {
+		long long t = get_nsec();
+		long long interval = w->frame_interval ? w->frame_interval : w->refresh;
+		int missed = 0;
+		if(w->last_present && interval) {
+			missed = (t - w->last_present + interval / 2) / interval - 1;
+			if(missed < 0) missed = 0;
+		}
+		w->last_present = t;
+		app_presented(w - windows, t, 1, missed);
+	}
+}
+
+// bounding rectangle of the newest count damage entries
+static void damage_union(const GLWindow *w, int count, int *rect)
+{
+	if(count > w->num_damage) {
+		rect[0] = rect[1] = 0;
+		rect[2] = w->width;
+		rect[3] = w->height;
+		return;
+	}
+
+	int xmin = INT_MAX, ymin = INT_MAX, xmax = 0, ymax = 0;
+	for(int i=0; i<count; i++) {
+		const int *r = w->damage[i];
+		if(r[2] <= 0 || r[3] <= 0) continue;
+		if(r[0] < xmin) xmin = r[0];
+		if(r[1] < ymin) ymin = r[1];
+		if(r[0] + r[2] > xmax) xmax = r[0] + r[2];
+		if(r[1] + r[3] > ymax) ymax = r[1] + r[3];
+	}
+	if(xmin >= xmax || ymin >= ymax) {
+		rect[0] = rect[1] = rect[2] = rect[3] = 0;
+		return;
+	}
+	rect[0] = xmin;
+	rect[1] = ymin;
+	rect[2] = xmax - xmin;
+	rect[3] = ymax - ymin;
+}
+
 static Bool match_motion_events(Display *dpy, XEvent *ev, XPointer arg)
 {
 	return ev->type == MotionNotify;
@@ -236,38 +867,54 @@ static Bool match_motion_events(Display *dpy, XEvent *ev, XPointer arg)
 
 static bool handle_event(XEvent *ev)
 {
-	static bool mapped;
 	static int prev_x, prev_y;
+	static bool dragging;
+
+	GLWindow *w = find_window(ev->xany.window);
+	if(!w) return true;
+
+	if(glx_swap_event_base >= 0 && ev->type == glx_swap_event_base + GLX_BufferSwapComplete) {
+		GLXBufferSwapComplete *sc = (GLXBufferSwapComplete*)ev;
+		if(present_exact(w)) {
+			swap_complete(w, sc->ust * 1000, sc->msc, sc->sbc);
+		}
+		return true;
+	}
 
 	switch(ev->type) {
 	case Expose:
-		if(mapped) {
-			redraw_pending = true;
+		if(w->mapped) {
+			w->redraw_pending = true;
 		}
+		w->num_damage = 0;
 		break;
 
 	case MapNotify:
-		mapped = true;
-		redraw_pending = true;
+		w->mapped = true;
+		w->redraw_pending = true;
 		break;
 
 	case UnmapNotify:
-		mapped = false;
-		redraw_pending = false;
+		w->mapped = false;
+		w->redraw_pending = false;
+		w->last_sbc = -1;	// don't count the time unmapped as missed frames
 		break;
 
 	case ConfigureNotify:
-		win_x = ev->xconfigure.x;
-		win_y = ev->xconfigure.y;
-		if(win_width != (int)ev->xconfigure.width || win_height != (int)ev->xconfigure.height) {
-			win_width = ev->xconfigure.width;
-			win_height = ev->xconfigure.height;
-			app_reshape(win_width, win_height);
+		w->x = ev->xconfigure.x;
+		w->y = ev->xconfigure.y;
+		if(w->width != (int)ev->xconfigure.width || w->height != (int)ev->xconfigure.height) {
+			w->width = ev->xconfigure.width;
+			w->height = ev->xconfigure.height;
+			w->num_damage = 0;
+			make_current(w);
+			app_reshape(w - windows, w->width, w->height);
 		}
 		break;
 
 	case KeyPress:
 	case KeyRelease:
+		cur_win = w;
 		app_keyboard(XLookupKeysym(&ev->xkey, 0) & 0xff, ev->type == KeyPress);
 		break;
 
@@ -279,29 +926,39 @@ static bool handle_event(XEvent *ev)
 		break;
 
 	case ButtonPress:
+		cur_win = w;
 		if(ev->xbutton.button == Button1) {
-			XGrabPointer(dpy, win, True, ButtonReleaseMask | Button1MotionMask,
+			// the left button drags the window around
+			XGrabPointer(dpy, w->win, True, ButtonReleaseMask | Button1MotionMask,
 					GrabModeAsync, GrabModeAsync, None, None, ev->xbutton.time);
 			prev_x = ev->xbutton.x_root;
 			prev_y = ev->xbutton.y_root;
+			dragging = true;
 
-			evmask &= ~StructureNotifyMask;
-			evmask |= ButtonReleaseMask;
-			XSelectInput(dpy, win, evmask);
+			w->evmask &= ~StructureNotifyMask;
+			XSelectInput(dpy, w->win, w->evmask);
+		} else {
+			app_mouse_button(w - windows, ev->xbutton.button - Button1, true,
+					ev->xbutton.x, ev->xbutton.y);
 		}
 		break;
 
 	case ButtonRelease:
 		if(ev->xbutton.button == Button1) {
-			evmask &= ~ButtonReleaseMask;
-			evmask |= StructureNotifyMask;
-			XSelectInput(dpy, win, evmask);
-			XUngrabPointer(dpy, ev->xbutton.time);
+			if(dragging) {
+				dragging = false;
+				w->evmask |= StructureNotifyMask;
+				XSelectInput(dpy, w->win, w->evmask);
+				XUngrabPointer(dpy, ev->xbutton.time);
+			}
+		} else {
+			app_mouse_button(w - windows, ev->xbutton.button - Button1, false,
+					ev->xbutton.x, ev->xbutton.y);
 		}
 		break;
 
 	case MotionNotify:
-		{
+		if(dragging) {
 			int x, y, dx = 0, dy = 0;
 
 			/* process all the pending motion events in one go */
@@ -314,9 +971,19 @@ static bool handle_event(XEvent *ev)
 				prev_y = y;
 			} while(XCheckIfEvent(dpy, ev, match_motion_events, 0));
 
-			win_x += dx;
-			win_y += dy;
-			XMoveWindow(dpy, win, win_x, win_y);
+			w->x += dx;
+			w->y += dy;
+			XMoveWindow(dpy, w->win, w->x, w->y);
+		} else {
+			// only the latest position matters
+			while(XCheckTypedWindowEvent(dpy, w->win, MotionNotify, ev));
+			app_mouse_motion(w - windows, ev->xmotion.x, ev->xmotion.y);
+		}
+		break;
+
+	case LeaveNotify:
+		if(!dragging) {
+			app_mouse_motion(w - windows, -1, -1);
 		}
 		break;
 
@@ -326,7 +993,225 @@ static bool handle_event(XEvent *ev)
 	return true;
 }
 
-static void set_window_title(const char *title)
+static void init_present_timing()
+{
+	if(use_egl) return;	// there's no EGL equivalent in Mesa
+
+	const char *ext = glXQueryExtensionsString(dpy, DefaultScreen(dpy));
+	if(!ext) return;
+
+	if(strstr(ext, "GLX_OML_sync_control")) {
+		glx_get_sync_values = (PFNGLXGETSYNCVALUESOMLPROC)
+			glXGetProcAddress((const GLubyte*)"glXGetSyncValuesOML");
+		glx_get_msc_rate = (PFNGLXGETMSCRATEOMLPROC)
+			glXGetProcAddress((const GLubyte*)"glXGetMscRateOML");
+	}
+	int err_base;
+	if(strstr(ext, "GLX_INTEL_swap_event") && !glXQueryExtension(dpy, &err_base, &glx_swap_event_base)) {
+		glx_swap_event_base = -1;
+	}
+
+	for(int i=0; i<num_windows; i++) {
+		GLWindow *w = windows + i;
+		w->last_msc = w->last_sbc = -1;
+
+		int32_t num, den;
+		if(glx_get_msc_rate && glx_get_msc_rate(dpy, w->win, &num, &den) && num > 0) {
+			w->refresh = 1000000000LL * den / num;
+		}
+		if(glx_swap_event_base >= 0) {
+			glXSelectEvent(dpy, w->win, GLX_BUFFER_SWAP_COMPLETE_INTEL_MASK);
+		}
+	}
+}
+
+/* when the next frame of w, if swapped now, will show up on screen: after
+ * any swaps still queued, on the vertical blank following the last one.
+ * Returns 0 if we can't tell.
+ */
+static long long predict_present(GLWindow *w, long long now)
+{
+	if(!present_exact(w)) return 0;
+
+	long long base, pending = 0;
+	if(glx_get_sync_values) {
+		int64_t ust, msc, sbc;
+		if(!glx_get_sync_values(dpy, w->win, &ust, &msc, &sbc) || ust <= 0) {
+			return 0;
+		}
+		if(glx_swap_event_base < 0) {
+			swap_complete(w, ust * 1000, msc, sbc);	// no events, poll instead
+		}
+		base = ust * 1000;
+		pending = w->swaps - sbc;
+	} else {
+		base = w->last_present;
+		if(w->last_sbc >= 0) {
+			pending = w->swaps - w->last_sbc;
+		}
+	}
+	if(!base || !w->refresh) return 0;
+
+	long long t = base + w->refresh;
+	if(now > base) {
+		t = base + ((now - base) / w->refresh + 1) * w->refresh;
+	}
+	if(pending > 0) {
+		t += pending * w->refresh;
+	}
+	return t;
+}
+
+/* the sync counters tell us exactly how many vertical blanks went by without
+ * a new frame. Windows we pace ourselves skip some on purpose, and use the
+ * fallback in end_frame.
+ */
+static bool present_exact(const GLWindow *w)
+{
+	return !use_egl && (glx_get_sync_values || glx_swap_event_base >= 0) && !w->frame_interval;
+}
+
+// swaps of w completed up to sbc, the last one at time t and vblank msc
+static void swap_complete(GLWindow *w, long long t, long long msc, long long sbc)
+{
+	if(w->last_sbc >= 0 && sbc <= w->last_sbc) return;
+
+	if(w->last_sbc >= 0) {
+		int frames = sbc - w->last_sbc;
+		long long vblanks = msc - w->last_msc;
+		if(!glx_get_msc_rate && vblanks > 0 && w->last_present) {
+			w->refresh = (t - w->last_present) / vblanks;
+		}
+		int missed = vblanks > frames ? vblanks - frames : 0;
+		app_presented(w - windows, t, frames, missed);
+	}
+	w->last_msc = msc;
+	w->last_sbc = sbc;
+	w->last_present = t;
+}
+
+static bool init_reactor()
+{
+	sigset_t sigmask;
+	sigemptyset(&sigmask);
+	sigaddset(&sigmask, SIGTERM);
+	sigaddset(&sigmask, SIGINT);
+	sigaddset(&sigmask, SIGHUP);
+	sigprocmask(SIG_BLOCK, &sigmask, 0);
+
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		perror("epoll_create1");
+		return false;
+	}
+	if((sig_fd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1 ||
+			(tick_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) == -1 ||
+			(frame_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+		perror("failed to set up the main loop");
+		close_reactor();
+		return false;
+	}
+	watch_fd(sig_fd);
+	watch_fd(tick_fd);
+	watch_fd(frame_fd);
+
+	arm_tick();
+	return true;
+}
+
+static void close_reactor()
+{
+	int *fds[] = {&sig_fd, &tick_fd, &frame_fd, &epfd};
+	for(int i=0; i<4; i++) {
+		if(*fds[i] != -1) {
+			close(*fds[i]);
+			*fds[i] = -1;
+		}
+	}
+}
+
+static void watch_fd(int fd)
+{
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* fire on every wall clock second boundary, so that the clocks change right
+ * on time. Setting the clock cancels the timer, and it's armed again.
+ */
+static void arm_tick()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	app_tick(now.tv_sec);
+
+	struct itimerspec its;
+	its.it_value.tv_sec = now.tv_sec + 1;
+	its.it_value.tv_nsec = 0;
+	its.it_interval.tv_sec = 1;
+	its.it_interval.tv_nsec = 0;
+	timerfd_settime(tick_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, 0);
+}
+
+/* wait for up to nsec nanoseconds for anything to happen, and handle it.
+ * X events are left queued for the main loop.
+ */
+static void wait_for_events(long long nsec)
+{
+	int timeout = nsec < 0 ? -1 : 0;
+	if(nsec > 0) {
+		// epoll only has millisecond timeouts, the frame timer is exact
+		struct itimerspec its;
+		memset(&its, 0, sizeof its);
+		its.it_value.tv_sec = nsec / 1000000000;
+		its.it_value.tv_nsec = nsec % 1000000000;
+		timerfd_settime(frame_fd, 0, &its, 0);
+		timeout = -1;
+	}
+
+	struct epoll_event evs[8];
+	int num = epoll_wait(epfd, evs, 8, timeout);
+
+	for(int i=0; i<num; i++) {
+		int fd = evs[i].data.fd;
+		uint64_t count;
+
+		if(fd == sig_fd) {
+			struct signalfd_siginfo si;
+			while(read(sig_fd, &si, sizeof si) == sizeof si) {
+				quit = true;
+			}
+
+		} else if(fd == tick_fd) {
+			if(read(tick_fd, &count, sizeof count) == -1 && errno == ECANCELED) {
+				arm_tick();
+			} else {
+				struct timespec now;
+				clock_gettime(CLOCK_REALTIME, &now);
+				/* expiring right on the boundary might still read as the
+				 * previous second, if the clocks disagree by a hair
+				 */
+				app_tick(now.tv_nsec > 999000000 ? now.tv_sec + 1 : now.tv_sec);
+			}
+
+		} else if(fd == frame_fd) {
+			read(frame_fd, &count, sizeof count);
+
+		} else {
+			ctl_handle(fd);	// the X connection falls through, XPending reads it
+		}
+	}
+}
+
+static long long get_nsec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void set_window_title(Window win, const char *title)
 {
 	XTextProperty text_prop;
 	XStringListToTextProperty((char**)&title, 1, &text_prop);
@@ -334,7 +1219,6 @@ static void set_window_title(const char *title)
 	XSetWMIconName(dpy, win, &text_prop);
 	XFree(text_prop.value);
 }
-
 struct mwm_hints{
     uint32_t flags;
     uint32_t functions;
@@ -350,6 +1234,9 @@ static void set_no_decoration(Window win)
 {
 	Atom wm_hints;
 
+	if(headless || !win) return;	// pbuffers have no window to decorate
+
+	// only if there's a window manager which knows about it
 	if((wm_hints = XInternAtom(dpy, "_MOTIF_WM_HINTS", True)) != None) {
 		struct mwm_hints hints = {MWM_HINTS_DEC, 0, MWM_DECOR_NONE, 0, 0};
 		XChangeProperty(dpy, win, wm_hints, wm_hints, 32, PropModeReplace,
@@ -362,6 +1249,8 @@ static void set_fullscreen_state(Window win, int op)
 	XEvent ev;
 	long evmask = SubstructureRedirectMask | SubstructureNotifyMask;
 
+	if(!dpy) return;
+
 	memset(&ev, 0, sizeof ev);
 
 	ev.type = ClientMessage;
@@ -376,6 +1265,37 @@ static void set_fullscreen_state(Window win, int op)
 	XSendEvent(dpy, root_win, 0, evmask, &ev);
 }
 
+static bool parse_output(const char *str, OutputSpec *spec)
+{
+	char buf[256];
+	if(strlen(str) >= sizeof buf) {
+		return false;
+	}
+	strcpy(buf, str);
+
+	spec->fps = 0;
+	char *fps_str = strchr(buf, '@');
+	if(fps_str) {
+		*fps_str++ = 0;
+		if((spec->fps = atoi(fps_str)) <= 0) {
+			return false;
+		}
+	}
+
+	unsigned int width = win_width, height = win_height;
+	spec->x = spec->y = 0;
+	int flags = XParseGeometry(buf, &spec->x, &spec->y, &width, &height);
+	if(!flags || width == 0 || height == 0) {
+		return false;
+	}
+	if((flags & (XValue | YValue)) != (XValue | YValue)) {
+		spec->x = -1;
+	}
+	spec->width = width;
+	spec->height = height;
+	return true;
+}
+
 static bool parse_args(int argc, char **argv)
 {
 	int i;
@@ -392,13 +1312,132 @@ static bool parse_args(int argc, char **argv)
 					win_x = -1;
 				}
 
+			} else if(strcmp(argv[i], "-output") == 0) {
+				if(num_out_spec >= MAX_OUTPUTS) {
+					fprintf(stderr, "too many outputs, max: %d\n", MAX_OUTPUTS);
+					return false;
+				}
+				if(!argv[++i] || !parse_output(argv[i], out_spec + num_out_spec)) {
+					fprintf(stderr, "-output must be followed by a geometry: WxH[+X+Y][@fps]\n");
+					return false;
+				}
+				num_out_spec++;
+
+			} else if(strcmp(argv[i], "-egl") == 0) {
+				use_egl = true;
+
+			} else if(strcmp(argv[i], "-headless") == 0) {
+				use_egl = headless = true;
+
+			} else if(strcmp(argv[i], "-split") == 0) {
+				opt.split_outputs = true;
+
 			} else if(strcmp(argv[i], "-fs") == 0) {
 				fullscreen = true;
 
+			} else if(strcmp(argv[i], "-zone") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-zone must be followed by a time zone name\n");
+					return false;
+				}
+				if(opt.num_zones >= MAX_ZONES) {
+					fprintf(stderr, "too many time zones, max: %d\n", MAX_ZONES);
+					return false;
+				}
+				opt.zones[opt.num_zones++] = argv[i];
+
+			} else if(strcmp(argv[i], "-pipeline") == 0) {
+				opt.pipeline = true;
+
+			} else if(strcmp(argv[i], "-raster") == 0) {
+				opt.raster_spawn = true;
+
+			} else if(strcmp(argv[i], "-noturb") == 0) {
+				opt.no_turbulence = true;
+
+			} else if(strcmp(argv[i], "-density") == 0) {
+				opt.density = true;
+
+			} else if(strcmp(argv[i], "-compact") == 0) {
+				opt.compact = true;
+
+			} else if(strcmp(argv[i], "-burst") == 0) {
+				opt.burst = true;
+
+			} else if(strcmp(argv[i], "-trails") == 0) {
+				opt.trails = true;
+
+			} else if(strcmp(argv[i], "-flipbook") == 0) {
+				opt.flipbook = true;
+
+			} else if(strcmp(argv[i], "-stats") == 0) {
+				opt.stats = true;
+
+			} else if(strcmp(argv[i], "-trace") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-trace must be followed by a filename\n");
+					return false;
+				}
+				opt.trace_fname = argv[i];
+
+			} else if(strcmp(argv[i], "-checkpoint") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-checkpoint must be followed by a filename\n");
+					return false;
+				}
+				opt.ckpt_fname = argv[i];
+
+			} else if(strcmp(argv[i], "-replay") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-replay must be followed by a trace filename\n");
+					return false;
+				}
+				opt.replay_fname = argv[i];
+
+			} else if(strcmp(argv[i], "-record") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-record must be followed by a filename, or - for stdout\n");
+					return false;
+				}
+				rec_fname = argv[i];
+
+			} else if(strcmp(argv[i], "-control") == 0) {
+				if(!argv[++i]) {
+					fprintf(stderr, "-control must be followed by a socket path\n");
+					return false;
+				}
+				ctl_path = argv[i];
+
+			} else if(strcmp(argv[i], "-record-fps") == 0) {
+				if(!argv[++i] || (rec_fps = atoi(argv[i])) <= 0) {
+					fprintf(stderr, "-record-fps must be followed by a positive number\n");
+					return false;
+				}
+
 			} else if(strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "-h") == 0) {
 				printf("Usage: %s [options]\n", argv[0]);
 				printf("options:\n");
 				printf(" -geometry [WxH][+X+Y]  set window size and/or position\n");
+				printf(" -record <file|->       record frames as a y4m stream to file or stdout\n");
+				printf(" -record-fps <fps>      frame rate to write in the y4m header (default: 60)\n");
+				printf(" -output WxH[+X+Y][@fps] open a window for another output/monitor\n");
+				printf(" -egl                   use EGL instead of GLX, and only swap the damaged region\n");
+				printf(" -headless              render to offscreen pbuffers, without an X server\n");
+				printf(" -split                 simulate each output separately\n");
+				printf(" -zone <tz>             add a clock for time zone tz (e.g. Europe/Athens)\n");
+				printf(" -pipeline              simulate the next frame while drawing the current one\n");
+				printf(" -raster                spawn from rasterized text instead of glyph outlines\n");
+				printf(" -noturb                disable flame turbulence\n");
+				printf(" -density               spread out crowded particles\n");
+				printf(" -compact               store particles in 16 bytes instead of 64 (no density interaction)\n");
+				printf(" -burst                 burst the flames of each digit as it changes\n");
+				printf(" -trails                leave fading trails behind the flames, with half the particles\n");
+				printf(" -flipbook              draw loops of the flames simulated in advance (cached)\n");
+				printf(" -stats                 print performance statistics periodically\n");
+				printf(" -trace <file>          record the input of the simulation to a trace file\n");
+				printf(" -checkpoint <file>     save the flames on exit, and carry on from them on startup\n");
+				printf(" -replay <file>         replay a trace file, then exit\n");
+				printf(" -control <path>        accept commands on a UNIX socket (stats, get, set, explode)\n");
 				printf(" -help                  print usage and exit\n");
 				return 0;
 			} else {
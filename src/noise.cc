@@ -0,0 +1,182 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "noise.h"
+
+static void add_octave(float *pot, int size, int res, float amp, unsigned int seed, float t);
+static float lattice(unsigned int seed, int key, int x, int y, int z, int chan);
+static inline unsigned int hash(unsigned int x);
+static inline float smooth(float t);
+
+NoiseVolume::NoiseVolume()
+{
+	cells = 0;
+	size = 0;
+	cell_scale = 1.0f;
+}
+
+NoiseVolume::~NoiseVolume()
+{
+	free(cells);
+}
+
+bool NoiseVolume::build(int size, unsigned int seed, float t)
+{
+	if(size < 2 || (size & (size - 1))) {
+		return false;
+	}
+
+	free(cells);
+	cells = 0;
+	this->size = 0;
+
+	int ncells = size * size * size;
+	void *mem;
+	if(posix_memalign(&mem, 16, ncells * 4 * sizeof(float)) != 0) {
+		return false;
+	}
+	cells = (float*)mem;
+	this->size = size;
+	cell_scale = (float)size / NOISE_FEATURES;
+
+	/* vector potential: two octaves of value noise, tiling over the volume,
+	 * for each of the three components
+	 */
+	std::vector<float> pot(ncells * 3, 0.0f);
+	add_octave(&pot[0], size, NOISE_FEATURES, 1.0f, seed, t);
+	add_octave(&pot[0], size, NOISE_FEATURES * 2, 0.5f, seed + 1, t * 2.0f);
+
+	// the field is the curl of the potential, by central differences
+	int mask = size - 1;
+	double sum_sq = 0.0;
+	float *cptr = cells;
+
+#define POT(x, y, z, c)	pot[((((z) & mask) * size + ((y) & mask)) * size + ((x) & mask)) * 3 + (c)]
+
+	for(int i=0; i<size; i++) {
+		for(int j=0; j<size; j++) {
+			for(int k=0; k<size; k++) {
+				float dzdy = POT(k, j + 1, i, 2) - POT(k, j - 1, i, 2);
+				float dydz = POT(k, j, i + 1, 1) - POT(k, j, i - 1, 1);
+				float dxdz = POT(k, j, i + 1, 0) - POT(k, j, i - 1, 0);
+				float dzdx = POT(k + 1, j, i, 2) - POT(k - 1, j, i, 2);
+				float dydx = POT(k + 1, j, i, 1) - POT(k - 1, j, i, 1);
+				float dxdy = POT(k, j + 1, i, 0) - POT(k, j - 1, i, 0);
+
+				cptr[0] = dzdy - dydz;
+				cptr[1] = dxdz - dzdx;
+				cptr[2] = dydx - dxdy;
+				cptr[3] = 0.0f;
+				sum_sq += cptr[0] * cptr[0] + cptr[1] * cptr[1] + cptr[2] * cptr[2];
+				cptr += 4;
+			}
+		}
+	}
+
+#undef POT
+
+	if(sum_sq > 0.0) {
+		float s = 1.0 / sqrt(sum_sq / ncells);
+		for(int i=0; i<ncells * 4; i++) {
+			cells[i] *= s;
+		}
+	}
+	return true;
+}
+
+/* value noise with res x res x res lattice points over the volume, blending
+ * between random lattices for consecutive integer values of t
+ */
+static void add_octave(float *pot, int size, int res, float amp, unsigned int seed, float t)
+{
+	int key = (int)floor(t);
+	float kt = smooth(t - key);
+
+	std::vector<float> lat(res * res * res * 3);
+	float *lptr = &lat[0];
+	for(int i=0; i<res; i++) {
+		for(int j=0; j<res; j++) {
+			for(int k=0; k<res; k++) {
+				for(int c=0; c<3; c++) {
+					float a = lattice(seed, key, k, j, i, c);
+					float b = lattice(seed, key + 1, k, j, i, c);
+					*lptr++ = a + (b - a) * kt;
+				}
+			}
+		}
+	}
+
+#define LAT(x, y, z)	(&lat[((((z) % res) * res + ((y) % res)) * res + ((x) % res)) * 3])
+
+	float scale = (float)res / size;
+	for(int i=0; i<size; i++) {
+		float fz = i * scale;
+		int z0 = (int)fz;
+		float tz = smooth(fz - z0);
+
+		for(int j=0; j<size; j++) {
+			float fy = j * scale;
+			int y0 = (int)fy;
+			float ty = smooth(fy - y0);
+
+			for(int k=0; k<size; k++) {
+				float fx = k * scale;
+				int x0 = (int)fx;
+				float tx = smooth(fx - x0);
+
+				for(int c=0; c<3; c++) {
+					float c00 = LAT(x0, y0, z0)[c] + (LAT(x0 + 1, y0, z0)[c] - LAT(x0, y0, z0)[c]) * tx;
+					float c10 = LAT(x0, y0 + 1, z0)[c] + (LAT(x0 + 1, y0 + 1, z0)[c] - LAT(x0, y0 + 1, z0)[c]) * tx;
+					float c01 = LAT(x0, y0, z0 + 1)[c] + (LAT(x0 + 1, y0, z0 + 1)[c] - LAT(x0, y0, z0 + 1)[c]) * tx;
+					float c11 = LAT(x0, y0 + 1, z0 + 1)[c] + (LAT(x0 + 1, y0 + 1, z0 + 1)[c] - LAT(x0, y0 + 1, z0 + 1)[c]) * tx;
+					float c0 = c00 + (c10 - c00) * ty;
+					float c1 = c01 + (c11 - c01) * ty;
+					*pot++ += (c0 + (c1 - c0) * tz) * amp;
+				}
+			}
+		}
+	}
+
+#undef LAT
+}
+
+// random value in [-1, 1] for a lattice point
+static float lattice(unsigned int seed, int key, int x, int y, int z, int chan)
+{
+	unsigned int h = hash(x * 73856093u ^ y * 19349663u ^ z * 83492791u ^ chan * 2654435761u);
+	h = hash(h ^ key * 0x9e3779b9u);
+	h = hash(h ^ seed);
+	return h / 2147483648.0f - 1.0f;
+}
+
+static inline unsigned int hash(unsigned int x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline float smooth(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
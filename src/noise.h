@@ -0,0 +1,117 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef NOISE_H_
+#define NOISE_H_
+
+#include "vec3.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#define NOISE_VOL_SIZE		32	// cells per side, must be a power of two
+#define NOISE_FEATURES		4	// noise features per side of the volume
+
+/* a tiling volume of curl noise: a divergence-free vector field, so it
+ * swirls particles around without bunching them up. Cells are padded to 4
+ * floats, so that trilinear lookups can interpolate all three components
+ * at once with SSE. Building one doesn't touch any shared state, so it can
+ * be done on any thread.
+ */
+class NoiseVolume {
+private:
+	float *cells;
+	int size;
+	float cell_scale;	// cells per noise feature
+
+	inline const float *cell(int x, int y, int z) const;
+
+public:
+	NoiseVolume();
+	~NoiseVolume();
+
+	NoiseVolume(const NoiseVolume&) = delete;
+	NoiseVolume &operator =(const NoiseVolume&) = delete;
+
+	/* the field evolves smoothly with t, by a noise feature's worth of change
+	 * per unit of t, so rebuilding it with increasing t animates it.
+	 * The field is scaled to an RMS magnitude of 1.
+	 */
+	bool build(int size, unsigned int seed, float t);
+
+	// p is in units of noise features
+	inline Vec3 lookup(const Vec3 &p) const;
+};
+
+inline const float *NoiseVolume::cell(int x, int y, int z) const
+{
+	int mask = size - 1;
+	return cells + ((((z & mask) * size) + (y & mask)) * size + (x & mask)) * 4;
+}
+
+inline Vec3 NoiseVolume::lookup(const Vec3 &p) const
+{
+	float x = p.x * cell_scale;
+	float y = p.y * cell_scale;
+	float z = p.z * cell_scale;
+	// floor without a libm call (no roundps before SSE4.1)
+	int x0 = (int)x - (x < 0.0f);
+	int y0 = (int)y - (y < 0.0f);
+	int z0 = (int)z - (z < 0.0f);
+	float fx = x - x0;
+	float fy = y - y0;
+	float fz = z - z0;
+
+#ifdef __SSE__
+	__m128 tx = _mm_set1_ps(fx);
+	__m128 ty = _mm_set1_ps(fy);
+	__m128 tz = _mm_set1_ps(fz);
+
+	__m128 c000 = _mm_load_ps(cell(x0, y0, z0));
+	__m128 c100 = _mm_load_ps(cell(x0 + 1, y0, z0));
+	__m128 c010 = _mm_load_ps(cell(x0, y0 + 1, z0));
+	__m128 c110 = _mm_load_ps(cell(x0 + 1, y0 + 1, z0));
+	__m128 c001 = _mm_load_ps(cell(x0, y0, z0 + 1));
+	__m128 c101 = _mm_load_ps(cell(x0 + 1, y0, z0 + 1));
+	__m128 c011 = _mm_load_ps(cell(x0, y0 + 1, z0 + 1));
+	__m128 c111 = _mm_load_ps(cell(x0 + 1, y0 + 1, z0 + 1));
+
+	__m128 c00 = _mm_add_ps(c000, _mm_mul_ps(_mm_sub_ps(c100, c000), tx));
+	__m128 c10 = _mm_add_ps(c010, _mm_mul_ps(_mm_sub_ps(c110, c010), tx));
+	__m128 c01 = _mm_add_ps(c001, _mm_mul_ps(_mm_sub_ps(c101, c001), tx));
+	__m128 c11 = _mm_add_ps(c011, _mm_mul_ps(_mm_sub_ps(c111, c011), tx));
+	__m128 c0 = _mm_add_ps(c00, _mm_mul_ps(_mm_sub_ps(c10, c00), ty));
+	__m128 c1 = _mm_add_ps(c01, _mm_mul_ps(_mm_sub_ps(c11, c01), ty));
+	__m128 c = _mm_add_ps(c0, _mm_mul_ps(_mm_sub_ps(c1, c0), tz));
+
+	float res[4];
+	_mm_storeu_ps(res, c);
+	return Vec3(res[0], res[1], res[2]);
+#else
+	Vec3 c[8];
+	for(int i=0; i<8; i++) {
+		const float *v = cell(x0 + (i & 1), y0 + ((i >> 1) & 1), z0 + (i >> 2));
+		c[i] = Vec3(v[0], v[1], v[2]);
+	}
+	Vec3 c0 = lerp(lerp(c[0], c[1], fx), lerp(c[2], c[3], fx), fy);
+	Vec3 c1 = lerp(lerp(c[4], c[5], fx), lerp(c[6], c[7], fx), fy);
+	return lerp(c0, c1, fz);
+#endif
+}
+
+#endif	// NOISE_H_
@@ -0,0 +1,30 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "opengl.h"
+
+bool gl_fbo_supported()
+{
+	const char *ver = (const char*)glGetString(GL_VERSION);
+	const char *ext = (const char*)glGetString(GL_EXTENSIONS);
+	if(ver && atoi(ver) >= 3) {
+		return true;
+	}
+	return ext && strstr(ext, "GL_ARB_framebuffer_object");
+}
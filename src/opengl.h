@@ -26,4 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <OpenGL/gl.h>
 #endif
 
+// true if the current context can render to textures through framebuffer objects
+bool gl_fbo_supported();
+
 #endif	// OPENGL_H_
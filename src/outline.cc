@@ -0,0 +1,298 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+#include "outline.h"
+
+#define CURVE_SEGMENTS	8
+
+typedef std::vector<Vec3> Contour;
+
+struct Edge {
+	float x0, y0, x1, y1;	// y0 < y1
+	int dir;
+};
+
+static int move_to(const FT_Vector *to, void *cls);
+static int line_to(const FT_Vector *to, void *cls);
+static int conic_to(const FT_Vector *ctl, const FT_Vector *to, void *cls);
+static int cubic_to(const FT_Vector *ctl1, const FT_Vector *ctl2, const FT_Vector *to, void *cls);
+static void triangulate(const std::vector<Contour> &contours, bool even_odd, std::vector<Vec3> *tris);
+static inline float edge_x(const Edge &e, float y);
+static void add_tri(std::vector<Vec3> *tris, const Vec3 &a, const Vec3 &b, const Vec3 &c);
+
+FontOutline::FontOutline()
+{
+	ft = 0;
+	face = 0;
+	line_height = 0.0f;
+	memset(glyphs, 0, sizeof glyphs);
+}
+
+FontOutline::~FontOutline()
+{
+	close();
+}
+
+bool FontOutline::open(const char *fname, int size)
+{
+	close();
+
+	if(FT_Init_FreeType(&ft) != 0) {
+		fprintf(stderr, "failed to initialize freetype\n");
+		ft = 0;
+		return false;
+	}
+	if(FT_New_Face(ft, fname, 0, &face) != 0) {
+		fprintf(stderr, "failed to open font outlines: %s\n", fname);
+		face = 0;
+		close();
+		return false;
+	}
+	FT_Set_Pixel_Sizes(face, 0, size);
+	line_height = face->size->metrics.height / 64.0f;
+	return true;
+}
+
+void FontOutline::close()
+{
+	for(int i=0; i<256; i++) {
+		delete glyphs[i];
+		glyphs[i] = 0;
+	}
+	if(face) {
+		FT_Done_Face(face);
+		face = 0;
+	}
+	if(ft) {
+		FT_Done_FreeType(ft);
+		ft = 0;
+	}
+}
+
+float FontOutline::get_line_height() const
+{
+	return line_height;
+}
+
+void FontOutline::string_mesh(const char *str, float x, float y, std::vector<Vec3> *tris,
+		std::vector<float> *cell_end)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	while(*str) {
+		const GlyphMesh *g = glyph((unsigned char)*str++);
+		if(!g) {
+			if(cell_end) cell_end->push_back(x);
+			continue;
+		}
+
+		size_t idx = tris->size();
+		tris->resize(idx + g->verts.size());
+		Vec3 *dest = tris->data() + idx;	// no triangles for a space
+
+		for(size_t i=0; i<g->verts.size(); i++) {
+			dest[i] = Vec3(x + g->verts[i].x, y - g->verts[i].y, 0);
+		}
+		x += g->advance;
+		if(cell_end) cell_end->push_back(x);
+	}
+}
+
+// called with the lock held
+const GlyphMesh *FontOutline::glyph(int c)
+{
+	if(c < 0 || c > 255 || !face) return 0;
+	if(glyphs[c]) return glyphs[c];
+
+	FT_UInt gidx = FT_Get_Char_Index(face, c);
+	if(FT_Load_Glyph(face, gidx, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING) != 0) {
+		return 0;
+	}
+
+	FT_Outline_Funcs funcs;
+	funcs.move_to = move_to;
+	funcs.line_to = line_to;
+	funcs.conic_to = conic_to;
+	funcs.cubic_to = cubic_to;
+	funcs.shift = 0;
+	funcs.delta = 0;
+
+	std::vector<Contour> contours;
+	FT_Outline *outline = &face->glyph->outline;
+	FT_Outline_Decompose(outline, &funcs, &contours);
+
+	GlyphMesh *g = new GlyphMesh;
+	g->advance = face->glyph->advance.x / 64.0f;
+	triangulate(contours, outline->flags & FT_OUTLINE_EVEN_ODD_FILL, &g->verts);
+
+	glyphs[c] = g;
+	return g;
+}
+
+static inline Vec3 ftvec(const FT_Vector *v)
+{
+	return Vec3(v->x / 64.0f, v->y / 64.0f, 0);
+}
+
+static int move_to(const FT_Vector *to, void *cls)
+{
+	std::vector<Contour> *contours = (std::vector<Contour>*)cls;
+	contours->push_back(Contour());
+	contours->back().push_back(ftvec(to));
+	return 0;
+}
+
+static int line_to(const FT_Vector *to, void *cls)
+{
+	std::vector<Contour> *contours = (std::vector<Contour>*)cls;
+	contours->back().push_back(ftvec(to));
+	return 0;
+}
+
+static int conic_to(const FT_Vector *ctl, const FT_Vector *to, void *cls)
+{
+	std::vector<Contour> *contours = (std::vector<Contour>*)cls;
+	Contour *cont = &contours->back();
+
+	Vec3 p0 = cont->back();
+	Vec3 p1 = ftvec(ctl);
+	Vec3 p2 = ftvec(to);
+
+	for(int i=1; i<=CURVE_SEGMENTS; i++) {
+		float t = (float)i / CURVE_SEGMENTS;
+		float s = 1.0f - t;
+		cont->push_back(p0 * (s * s) + p1 * (2.0f * s * t) + p2 * (t * t));
+	}
+	return 0;
+}
+
+static int cubic_to(const FT_Vector *ctl1, const FT_Vector *ctl2, const FT_Vector *to, void *cls)
+{
+	std::vector<Contour> *contours = (std::vector<Contour>*)cls;
+	Contour *cont = &contours->back();
+
+	Vec3 p0 = cont->back();
+	Vec3 p1 = ftvec(ctl1);
+	Vec3 p2 = ftvec(ctl2);
+	Vec3 p3 = ftvec(to);
+
+	for(int i=1; i<=CURVE_SEGMENTS; i++) {
+		float t = (float)i / CURVE_SEGMENTS;
+		float s = 1.0f - t;
+		cont->push_back(p0 * (s * s * s) + p1 * (3.0f * s * s * t) +
+				p2 * (3.0f * s * t * t) + p3 * (t * t * t));
+	}
+	return 0;
+}
+
+/* cut the filled area of a set of closed contours into trapezoids, by
+ * sweeping horizontal slabs between consecutive vertex heights, and split
+ * each trapezoid in two triangles. Handles holes and either fill rule, as
+ * long as the contours don't cross each other.
+ */
+static void triangulate(const std::vector<Contour> &contours, bool even_odd, std::vector<Vec3> *tris)
+{
+	std::vector<Edge> edges;
+	std::vector<float> ys;
+
+	for(size_t i=0; i<contours.size(); i++) {
+		const Contour &cont = contours[i];
+		int num = (int)cont.size();
+
+		for(int j=0; j<num; j++) {
+			const Vec3 &a = cont[j];
+			const Vec3 &b = cont[(j + 1) % num];
+			ys.push_back(a.y);
+			if(a.y == b.y) continue;
+
+			Edge e;
+			if(a.y < b.y) {
+				e.x0 = a.x; e.y0 = a.y; e.x1 = b.x; e.y1 = b.y;
+				e.dir = 1;
+			} else {
+				e.x0 = b.x; e.y0 = b.y; e.x1 = a.x; e.y1 = a.y;
+				e.dir = -1;
+			}
+			edges.push_back(e);
+		}
+	}
+
+	std::sort(ys.begin(), ys.end());
+	ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+	std::vector<std::pair<float, int>> cross;
+
+	for(size_t i=1; i<ys.size(); i++) {
+		float ya = ys[i - 1];
+		float yb = ys[i];
+		float ymid = (ya + yb) * 0.5f;
+
+		// edges spanning this slab, ordered left to right
+		cross.clear();
+		for(size_t j=0; j<edges.size(); j++) {
+			if(edges[j].y0 <= ya && edges[j].y1 >= yb) {
+				cross.push_back(std::make_pair(edge_x(edges[j], ymid), (int)j));
+			}
+		}
+		std::sort(cross.begin(), cross.end());
+
+		int wind = 0;
+		int left = -1;
+		for(size_t j=0; j<cross.size(); j++) {
+			const Edge &e = edges[cross[j].second];
+			bool was_inside = even_odd ? (wind & 1) : wind != 0;
+			wind += e.dir;
+			bool inside = even_odd ? (wind & 1) : wind != 0;
+
+			if(!was_inside && inside) {
+				left = cross[j].second;
+			} else if(was_inside && !inside && left >= 0) {
+				const Edge &le = edges[left];
+				Vec3 la = Vec3(edge_x(le, ya), ya, 0);
+				Vec3 lb = Vec3(edge_x(le, yb), yb, 0);
+				Vec3 ra = Vec3(edge_x(e, ya), ya, 0);
+				Vec3 rb = Vec3(edge_x(e, yb), yb, 0);
+
+				add_tri(tris, la, ra, rb);
+				add_tri(tris, la, rb, lb);
+			}
+		}
+	}
+}
+
+static inline float edge_x(const Edge &e, float y)
+{
+	return e.x0 + (y - e.y0) * (e.x1 - e.x0) / (e.y1 - e.y0);
+}
+
+// degenerate triangles (trapezoids with a pointy end) are dropped
+static void add_tri(std::vector<Vec3> *tris, const Vec3 &a, const Vec3 &b, const Vec3 &c)
+{
+	float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+	if(fabs(area) < 1e-6) return;
+
+	tris->push_back(a);
+	tris->push_back(b);
+	tris->push_back(c);
+}
@@ -0,0 +1,68 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef OUTLINE_H_
+#define OUTLINE_H_
+
+#include <vector>
+#include <mutex>
+#include "vec3.h"
+
+struct FT_LibraryRec_;
+struct FT_FaceRec_;
+
+// glyph outline as triangles, y up from the baseline, in pixels
+struct GlyphMesh {
+	std::vector<Vec3> verts;	// 3 per triangle
+	float advance;
+};
+
+/* glyph outlines of a font, read with FreeType, flattened and cut into
+ * triangles the first time each glyph is used. Safe to use from any thread.
+ */
+class FontOutline {
+private:
+	FT_LibraryRec_ *ft;
+	FT_FaceRec_ *face;
+	float line_height;
+
+	GlyphMesh *glyphs[256];
+	std::mutex lock;
+
+	const GlyphMesh *glyph(int c);
+
+public:
+	FontOutline();
+	~FontOutline();
+
+	FontOutline(const FontOutline&) = delete;
+	FontOutline &operator =(const FontOutline&) = delete;
+
+	bool open(const char *fname, int size);
+	void close();
+
+	float get_line_height() const;
+
+	/* append the triangles of a string to tris, with the pen starting at x, y,
+	 * in raster coordinates (y down, baseline at y). If cell_end isn't null,
+	 * the pen position after each character is appended to it.
+	 */
+	void string_mesh(const char *str, float x, float y, std::vector<Vec3> *tris,
+			std::vector<float> *cell_end = 0);
+};
+
+#endif	// OUTLINE_H_
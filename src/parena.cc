@@ -0,0 +1,291 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <algorithm>
+#include "parena.h"
+#include "psys.h"
+
+#define CACHE_BATCH		64
+#define CACHE_MAX		(CACHE_BATCH * 2)
+
+ParticleArena::ParticleArena(int chunk_size)
+{
+	this->chunk_size = chunk_size > 0 ? chunk_size : 1024;
+	bump_chunk = bump_idx = 0;
+	freelist = 0;
+	memset(&stats, 0, sizeof stats);
+}
+
+ParticleArena::~ParticleArena()
+{
+	for(size_t i=0; i<chunks.size(); i++) {
+		delete [] chunks[i];
+	}
+}
+
+void ParticleArena::add_chunk()
+{
+	chunks.push_back(new Particle[chunk_size]);
+	stats.capacity += chunk_size;
+	stats.num_chunks++;
+}
+
+void ParticleArena::reserve(int count)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while(stats.capacity < count) {
+		add_chunk();
+	}
+}
+
+Particle *ParticleArena::alloc_nolock()
+{
+	Particle *p;
+
+	if(freelist) {
+		p = freelist;
+		freelist = freelist->next;
+	} else {
+		if(bump_chunk < (int)chunks.size() && bump_idx >= chunk_size) {
+			bump_chunk++;
+			bump_idx = 0;
+		}
+		if(bump_chunk >= (int)chunks.size()) {
+			add_chunk();
+			bump_chunk = chunks.size() - 1;
+			bump_idx = 0;
+		}
+		p = chunks[bump_chunk] + bump_idx++;
+	}
+
+	stats.num_alloc++;
+	if(++stats.live > stats.high_water) {
+		stats.high_water = stats.live;
+	}
+	return p;
+}
+
+Particle *ParticleArena::alloc()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	return alloc_nolock();
+}
+
+void ParticleArena::free(Particle *p)
+{
+	if(!p) return;
+
+	std::unique_lock<std::mutex> guard(lock);
+	p->next = freelist;
+	freelist = p;
+	stats.live--;
+	stats.num_free++;
+}
+
+Particle *ParticleArena::alloc_list(int count, Particle *rest)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	Particle *head = rest;
+	for(int i=0; i<count; i++) {
+		Particle *p = alloc_nolock();
+		p->next = head;
+		head = p;
+	}
+	return head;
+}
+
+void ParticleArena::free_list(Particle *plist, Particle *tail, int count)
+{
+	if(!plist) return;
+
+	if(!tail || count < 0) {
+		count = 1;
+		tail = plist;
+		while(tail->next) {
+			tail = tail->next;
+			count++;
+		}
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	tail->next = freelist;
+	freelist = plist;
+	stats.live -= count;
+	stats.num_free += count;
+}
+
+void ParticleArena::reset()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	freelist = 0;
+	bump_chunk = bump_idx = 0;
+	stats.num_free += stats.live;
+	stats.live = 0;
+	stats.high_water = 0;
+}
+
+void ParticleArena::trim()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	int nchunks = chunks.size();
+	if(!nchunks) return;
+
+	// turn the never-used particles into regular free particles
+	for(int i=bump_chunk; i<nchunks; i++) {
+		for(int j=i == bump_chunk ? bump_idx : 0; j<chunk_size; j++) {
+			Particle *p = chunks[i] + j;
+			p->next = freelist;
+			freelist = p;
+		}
+	}
+	bump_chunk = nchunks;
+	bump_idx = 0;
+
+	// count free particles per chunk, to find which chunks are completely unused
+	std::sort(chunks.begin(), chunks.end());
+	std::vector<int> nfree(nchunks, 0);
+
+	Particle *p = freelist;
+	while(p) {
+		int idx = std::upper_bound(chunks.begin(), chunks.end(), p) - chunks.begin() - 1;
+		nfree[idx]++;
+		p = p->next;
+	}
+
+	std::vector<Particle*> keep;
+	for(int i=0; i<nchunks; i++) {
+		if(nfree[i] < chunk_size) {
+			keep.push_back(chunks[i]);
+		}
+	}
+	if((int)keep.size() == nchunks) {
+		stats.high_water = stats.live;
+		return;
+	}
+
+	// rebuild the free list without the particles of the chunks to be released
+	Particle dummy;
+	dummy.next = freelist;
+	p = &dummy;
+	while(p->next) {
+		Particle *fp = p->next;
+		int idx = std::upper_bound(chunks.begin(), chunks.end(), fp) - chunks.begin() - 1;
+		if(nfree[idx] == chunk_size) {
+			p->next = fp->next;
+		} else {
+			p = fp;
+		}
+	}
+	freelist = dummy.next;
+
+	for(int i=0; i<nchunks; i++) {
+		if(nfree[i] == chunk_size) {
+			delete [] chunks[i];
+		}
+	}
+	chunks.swap(keep);
+	bump_chunk = chunks.size();
+
+	stats.num_chunks = chunks.size();
+	stats.capacity = stats.num_chunks * chunk_size;
+	stats.high_water = stats.live;
+}
+
+void ParticleArena::get_stats(PArenaStats *st)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	*st = stats;
+}
+
+
+ParticleCache::ParticleCache(ParticleArena *arena)
+{
+	this->arena = arena;
+	list = 0;
+	count = 0;
+}
+
+ParticleCache::~ParticleCache()
+{
+	flush();
+}
+
+void ParticleCache::set_arena(ParticleArena *arena)
+{
+	flush();
+	this->arena = arena;
+}
+
+Particle *ParticleCache::alloc()
+{
+	if(!list) {
+		list = arena->alloc_list(CACHE_BATCH);
+		count = CACHE_BATCH;
+	}
+	Particle *p = list;
+	list = list->next;
+	count--;
+	return p;
+}
+
+void ParticleCache::reserve(int n)
+{
+	if(n > count) {
+		list = arena->alloc_list(n - count, list);
+		count = n;
+	}
+}
+
+void ParticleCache::free(Particle *p)
+{
+	p->next = list;
+	list = p;
+
+	if(++count >= CACHE_MAX) {
+		// give a batch back, keep the rest for subsequent allocations
+		Particle *tail = list;
+		for(int i=1; i<CACHE_BATCH; i++) {
+			tail = tail->next;
+		}
+		Particle *rest = tail->next;
+		arena->free_list(list, tail, CACHE_BATCH);
+		list = rest;
+		count -= CACHE_BATCH;
+	}
+}
+
+void ParticleCache::flush()
+{
+	if(list) {
+		Particle *tail = list;
+		while(tail->next) {
+			tail = tail->next;
+		}
+		arena->free_list(list, tail, count);
+	}
+	list = 0;
+	count = 0;
+}
+
+void ParticleCache::discard()
+{
+	list = 0;
+	count = 0;
+}
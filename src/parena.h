@@ -0,0 +1,112 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PARENA_H_
+#define PARENA_H_
+
+#include <vector>
+#include <mutex>
+
+struct Particle;
+
+struct PArenaStats {
+	int live;			// particles currently allocated
+	int high_water;		// peak live particles since the last reset or trim
+	int capacity;		// particles backed by allocated chunks
+	int num_chunks;
+	unsigned long num_alloc, num_free;
+};
+
+/* chunked slab allocator for the particles of a single particle system.
+ * Particles never move once allocated; free particles are kept in a list
+ * threaded through Particle::next, and never-used particles are handed out
+ * from the end of the last chunk. All methods are thread-safe, but meant to
+ * be called through a ParticleCache, a batch at a time.
+ */
+class ParticleArena {
+private:
+	std::vector<Particle*> chunks;
+	int chunk_size;
+	int bump_chunk, bump_idx;	// next never-used particle
+	Particle *freelist;
+	std::mutex lock;
+	PArenaStats stats;
+
+	Particle *alloc_nolock();
+	void add_chunk();
+
+public:
+	explicit ParticleArena(int chunk_size = 1024);
+	~ParticleArena();
+
+	ParticleArena(const ParticleArena&) = delete;
+	ParticleArena &operator =(const ParticleArena&) = delete;
+
+	// make sure there's room for at least count particles
+	void reserve(int count);
+
+	Particle *alloc();
+	void free(Particle *p);
+
+	/* allocate count particles, returned linked through their next pointers,
+	 * in front of the list rest
+	 */
+	Particle *alloc_list(int count, Particle *rest = 0);
+	// free a whole list, faster if the tail and length are known
+	void free_list(Particle *plist, Particle *tail = 0, int count = -1);
+
+	/* free every particle at once, without walking any lists. Any particle
+	 * pointers held elsewhere (including in ParticleCaches) become invalid.
+	 */
+	void reset();
+	// release the chunks which have no live particles
+	void trim();
+
+	void get_stats(PArenaStats *st);
+};
+
+/* per-thread front end to a ParticleArena. Keeps a small stash of free
+ * particles so that most allocations don't touch the arena lock. Not
+ * thread-safe; each spawning thread must use its own cache.
+ */
+class ParticleCache {
+private:
+	ParticleArena *arena;
+	Particle *list;
+	int count;
+
+public:
+	explicit ParticleCache(ParticleArena *arena = 0);
+	~ParticleCache();
+
+	ParticleCache(const ParticleCache&) = delete;
+	ParticleCache &operator =(const ParticleCache&) = delete;
+
+	void set_arena(ParticleArena *arena);
+
+	Particle *alloc();
+	// stash enough particles for the next count allocations, with a single lock
+	void reserve(int count);
+	void free(Particle *p);
+
+	// return all stashed particles to the arena
+	void flush();
+	// forget the stash without returning it, after ParticleArena::reset
+	void discard();
+};
+
+#endif	// PARENA_H_
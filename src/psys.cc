@@ -17,18 +17,60 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
 #include <vector>
 #include <algorithm>
 #include "opengl.h"
 #include "psys.h"
-
-#define MAX_SPAWNMAP_SAMPLES	2048
-
-static double frand();
-static float rndval(float x, float range);
-static Particle *palloc();
-static void pfree(Particle *p);
-static void pfreelist(Particle *p);
+#include "affect.h"
+#include "tpool.h"
+#include "rng.h"
+
+// header of a saved state, followed by the particles of each cell in order
+struct PSysState {
+	unsigned int compact;
+	unsigned int count;
+	unsigned int cell_count[PSYS_MAX_CELLS];
+	float cexpl_dur[PSYS_MAX_CELLS];
+	unsigned int rng_state;
+	float active_time;
+	float spawn_pending;
+	unsigned int part_size;		// bytes per particle
+};
+
+// particles are saved without their next pointer, which is their last field
+#define SAVED_PART_SIZE		offsetof(Particle, next)
+
+// particles spawned at a time
+#define PSYS_SPAWN_BATCH	64
+// random numbers to jitter the position, lifetime and size of a particle
+#define SPAWN_JITTER_RND	5
+
+// points of the ramps checked for whether a particle has faded out
+#define FADE_STEPS			256
+// no view set, particles are never out of it
+#define VIEW_UNBOUNDED		1e30f
+
+// storage units of the affectors, for each kind of particle
+static const AffectUnits full_units = {1.0f, 1.0f};
+static const AffectUnits compact_units = {CPART_POS_SCALE, CPART_VEL_SCALE};
+
+// attributes of a batch of new particles, one array each
+struct PSysSpawnBatch {
+	float x[PSYS_SPAWN_BATCH], y[PSYS_SPAWN_BATCH], z[PSYS_SPAWN_BATCH];
+	float life[PSYS_SPAWN_BATCH], size[PSYS_SPAWN_BATCH];
+	int cell[PSYS_SPAWN_BATCH];
+	unsigned int rnd[PSYS_SPAWN_BATCH * (SPAWN_JITTER_RND + SPAWNMAP_MESH_RND)];
+};
+
+static int begin_draw(Image *pimg);
+static void end_draw(int cur_sdr);
+static inline float jitter(unsigned int r, float x, float range);
+static float fade_cutoff(const PSysParam &pp);
+static bool same_fade(const PSysParam &a, const PSysParam &b);
+static inline void vertex_bounds(const Vec3 &pos, float hsz, Vec3 *bmin, Vec3 *bmax);
 
 void psys_default(PSysParam *pp)
 {
@@ -41,8 +83,17 @@ void psys_default(PSysParam *pp)
 	pp->size_range = 0.0;
 	pp->spawn_map = 0;
 	pp->spawn_map_speed = 0.0;
+	pp->spawn_map_scale = 1.0;
 
 	pp->gravity = Vec3(0, -9.2, 0);
+	pp->drag = 0.0;
+
+	pp->turb = 0;
+	pp->turb_strength = 1.0;
+	pp->turb_freq = 1.0;
+
+	pp->density_strength = 0.0;
+	pp->density_radius = 0.02;
 
 	pp->pimg = 0;
 	pp->pcolor_start = pp->pcolor_mid = pp->pcolor_end = Vec3(1, 1, 1);
@@ -50,58 +101,225 @@ void psys_default(PSysParam *pp)
 	pp->palpha_mid = 0.5;
 	pp->palpha_end = 0.0;
 	pp->pscale_start = pp->pscale_mid = pp->pscale_end = 1.0;
+
+	pp->cull_contrib = 0.5 / 255.0;
+
+	pp->trail_halflife = 0.0;
+	pp->trail_drift = Vec3(0, 0, 0);
 }
 
 ParticleSystem::ParticleSystem()
 {
+	// distinct, but repeatable, random sequences for each system
+	static unsigned int next_seed;
+	seed(++next_seed * 0x9e3779b9);
+
 	active = true;
 	active_time = 0.0f;
 	spawn_pending = 0.0f;
-	plist = 0;
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		plist[i] = 0;
+		cexpl_dur[i] = 0.0f;
+	}
 	pcount = 0;
-	smcache = 0;
-
-	expl = false;
-	expl_force = expl_dur = 0.0f;
+	spawnmap = 0;
+	new_spawnmap = 0;
+	pointer_active = false;
+	pcache.set_arena(&arena);
+
+	fade_cut = 1.0f;
+	fade_valid = false;
+	view_min = cull_min = Vec3(-VIEW_UNBOUNDED, -VIEW_UNBOUNDED, 0);
+	view_max = cull_max = Vec3(VIEW_UNBOUNDED, VIEW_UNBOUNDED, 0);
+	num_faded = num_offview = 0;
+
+	compact = false;
+	chigh_water = 0;
+	cnum_alloc = cnum_free = 0;
+	publish_compact_stats();
+
+	expl_cells = 0;
 	expl_life = 0.0f;
+	trim_time = 0.0f;
 
 	psys_default(&pp);
 }
 
 ParticleSystem::~ParticleSystem()
 {
-	pfreelist(plist);
-	delete [] smcache;
+	delete spawnmap;
+	delete new_spawnmap.exchange(0);
 }
 
 void ParticleSystem::reset()
 {
-	pfreelist(plist);
-	delete [] smcache;
-	smcache = 0;
+	clear_particles();
+
+	reset_spawnmap();
+	pointer_active = false;
 
 	active = true;
 	active_time = 0.0f;
 	spawn_pending = 0.0f;
+	trim_time = 0.0f;
 
 	psys_default(&pp);
 }
 
+void ParticleSystem::set_compact(bool c)
+{
+	if(c == compact) return;
+
+	clear_particles();
+	compact = c;
+}
+
+// release all particles at once, instead of walking the lists
+void ParticleSystem::clear_particles()
+{
+	pcache.discard();
+	arena.reset();
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		plist[i] = 0;
+		cparts[i].clear();
+	}
+	pcount = 0;
+	publish_compact_stats();
+}
+
+bool ParticleSystem::is_compact() const
+{
+	return compact;
+}
+
 void ParticleSystem::reset_spawnmap()
 {
-	delete [] smcache;
-	smcache = 0;
+	delete spawnmap;
+	spawnmap = 0;
+	delete new_spawnmap.exchange(0);
 }
 
-void ParticleSystem::explode(const Vec3 &c, float force, float dur, float life)
+void ParticleSystem::set_spawnmap(SpawnMap *sm)
+{
+	// if the previous one was never picked up by update, it's stale anyway
+	delete new_spawnmap.exchange(sm);
+}
+
+void ParticleSystem::seed(unsigned int s)
+{
+	rng_state = s ? s : 0x2545f491;	// xorshift must never be seeded with 0
+}
+
+void ParticleSystem::reserve(int count)
+{
+	if(compact) {
+		// the cells share the particles unevenly, this is only a starting point
+		for(int i=0; i<PSYS_MAX_CELLS; i++) {
+			cparts[i].reserve(count / PSYS_MAX_CELLS);
+		}
+	} else {
+		arena.reserve(count);
+	}
+}
+
+void ParticleSystem::trim()
+{
+	if(compact) {
+		for(int i=0; i<PSYS_MAX_CELLS; i++) {
+			cparts[i].shrink_to_fit();
+		}
+		chigh_water = pcount;
+		publish_compact_stats();
+	} else {
+		pcache.flush();
+		arena.trim();
+	}
+}
+
+void ParticleSystem::get_stats(PArenaStats *st)
 {
-	if(expl) return;
+	if(compact) {
+		std::lock_guard<std::mutex> guard(cstats_lock);
+		*st = cstats;
+	} else {
+		arena.get_stats(st);
+	}
+}
 
-	expl_dur = dur;
-	expl_force = force;
-	expl_cent = c;
+void ParticleSystem::explode(const Vec3 &c, float force, float dur, float life)
+{
+	// cells which already have an explosion pending keep it
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		if(expl_cells & (1 << i)) continue;
+		expl[i].cent = c;
+		expl[i].centroid = false;
+		expl[i].force = force;
+		expl[i].dur = dur;
+	}
 	expl_life = life;
-	expl = true;
+	expl_cells |= (1 << PSYS_MAX_CELLS) - 1;
+	if(dur > trim_time) trim_time = dur;
+}
+
+void ParticleSystem::explode_cell(int cell, float force, float dur)
+{
+	if(cell < 0 || cell >= PSYS_MAX_CELLS || (expl_cells & (1 << cell))) {
+		return;
+	}
+
+	expl[cell].centroid = true;
+	expl[cell].force = force;
+	expl[cell].dur = dur;
+	expl_cells |= 1 << cell;
+	if(dur > trim_time) trim_time = dur;
+}
+
+// center of an explosion, relative to the system, before it's applied
+Vec3 ParticleSystem::explosion_center(int cell) const
+{
+	if(!expl[cell].centroid) {
+		return expl[cell].cent;
+	}
+
+	Vec3 sum = Vec3(0, 0, 0);
+	int count = 0;
+	if(compact) {
+		const std::vector<CompactParticle> &parts = cparts[cell];
+		for(size_t i=0; i<parts.size(); i++) {
+			sum += Vec3(parts[i].pos[0], parts[i].pos[1], parts[i].pos[2]) * (1.0f / CPART_POS_SCALE);
+		}
+		count = parts.size();
+	} else {
+		Particle *p = plist[cell];
+		while(p) {
+			sum += p->pos;
+			count++;
+			p = p->next;
+		}
+	}
+	return count ? sum * (1.0f / count) - pos : Vec3(0, 0, 0);
+}
+
+void ParticleSystem::set_pointer(const PSysPointer *ptr)
+{
+	if(ptr) {
+		pointer = *ptr;
+		pointer_active = true;
+	} else {
+		pointer_active = false;
+	}
+}
+
+void ParticleSystem::set_view(const Vec3 &vmin, const Vec3 &vmax)
+{
+	view_min = vmin;
+	view_max = vmax;
+}
+
+void ParticleSystem::get_cull_stats(unsigned long *faded, unsigned long *offview) const
+{
+	*faded = num_faded;
+	*offview = num_offview;
 }
 
 bool ParticleSystem::alive() const
@@ -109,30 +327,318 @@ bool ParticleSystem::alive() const
 	return active || pcount > 0;
 }
 
+size_t ParticleSystem::state_size() const
+{
+	size_t part_size = compact ? sizeof(CompactParticle) : SAVED_PART_SIZE;
+	return sizeof(PSysState) + pcount * part_size;
+}
+
+void ParticleSystem::save_state(void *buf) const
+{
+	PSysState *st = (PSysState*)buf;
+	st->compact = compact ? 1 : 0;
+	st->count = pcount;
+	st->rng_state = rng_state;
+	st->active_time = active_time;
+	st->spawn_pending = spawn_pending;
+	st->part_size = compact ? sizeof(CompactParticle) : SAVED_PART_SIZE;
+
+	char *dest = (char*)(st + 1);
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		st->cexpl_dur[i] = cexpl_dur[i];
+
+		if(compact) {
+			st->cell_count[i] = cparts[i].size();
+			if(!cparts[i].empty()) {
+				memcpy(dest, &cparts[i][0], cparts[i].size() * sizeof(CompactParticle));
+				dest += cparts[i].size() * sizeof(CompactParticle);
+			}
+		} else {
+			int count = 0;
+			Particle *p = plist[i];
+			while(p) {
+				memcpy(dest, p, SAVED_PART_SIZE);
+				dest += SAVED_PART_SIZE;
+				count++;
+				p = p->next;
+			}
+			st->cell_count[i] = count;
+		}
+	}
+}
+
+bool ParticleSystem::load_state(const void *buf, size_t size)
+{
+	PSysState st;
+	if(size < sizeof st) return false;
+	memcpy(&st, buf, sizeof st);
+
+	size_t part_size = compact ? sizeof(CompactParticle) : SAVED_PART_SIZE;
+	unsigned long total = 0;
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		total += st.cell_count[i];
+	}
+	if(st.compact != (compact ? 1u : 0u) || st.part_size != part_size ||
+			total != st.count || (size - sizeof st) / part_size < st.count) {
+		return false;
+	}
+
+	clear_particles();
+
+	const char *src = (const char*)buf + sizeof st;
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		unsigned int count = st.cell_count[i];
+		cexpl_dur[i] = st.cexpl_dur[i];
+
+		if(compact) {
+			cparts[i].resize(count);
+			if(count) memcpy(&cparts[i][0], src, count * part_size);
+			src += count * part_size;
+		} else {
+			// allocated as a list in one go, then filled in the saved order
+			plist[i] = arena.alloc_list(count);
+			Particle *p = plist[i];
+			while(p) {
+				memcpy(p, src, part_size);
+				src += part_size;
+				p = p->next;
+			}
+		}
+	}
+	pcount = st.count;
+	if(compact) {
+		cnum_alloc += st.count;
+		if((int)st.count > chigh_water) {
+			chigh_water = st.count;
+		}
+		publish_compact_stats();
+	}
+
+	seed(st.rng_state);
+	active_time = st.active_time;
+	spawn_pending = st.spawn_pending;
+	active = true;
+	return true;
+}
+
+unsigned int ParticleSystem::features() const
+{
+	unsigned int feat = 0;
+
+	if(pp.spawn_map || spawnmap) {
+		feat |= PSYS_SPAWNMAP;
+	}
+	if(spawnmap && spawnmap->num_tris > 0) {
+		feat |= PSYS_SPAWNMESH;
+	}
+	if(fabs(pp.spawn_range) >= 1e-6 || fabs(pp.life_range) >= 1e-6 ||
+			fabs(pp.size_range) >= 1e-6) {
+		feat |= PSYS_JITTER;
+	}
+	if(pp.gravity.x != 0.0 || pp.gravity.y != 0.0 || pp.gravity.z != 0.0) {
+		feat |= PSYS_GRAVITY;
+	}
+	if(pp.turb && pp.turb_strength != 0.0) {
+		feat |= PSYS_TURB;
+	}
+	if(pp.drag > 0.0) {
+		feat |= PSYS_DRAG;
+	}
+	if(pointer_active && pointer.radius > 0.0) {
+		feat |= PSYS_POINTER;
+	}
+	if(pp.pimg) {
+		feat |= PSYS_TEXTURED;
+	}
+	return feat;
+}
+
+// pick up a spawn map handed over by set_spawnmap, or build one if needed
+void ParticleSystem::switch_spawnmap()
+{
+	SpawnMap *sm = new_spawnmap.exchange(0);
+	if(sm) {
+		delete spawnmap;
+		spawnmap = sm;
+	}
+	if(!spawnmap && pp.spawn_map) {
+		spawnmap = new SpawnMap;
+		spawnmap->build(pp.spawn_map, SPAWNMAP_DEF_SAMPLES, rng_next(&rng_state));
+	}
+}
+
 void ParticleSystem::update(float dt)
 {
-	if(pp.spawn_map && !smcache) {
-		gen_spawnmap(MAX_SPAWNMAP_SAMPLES);
+	// before selecting the kernel, since the kind of spawn map matters
+	switch_spawnmap();
+	update_culling();
+
+	unsigned int feat = features();
+	unsigned int aff = (feat & PSYS_AFFECT_MASK) >> PSYS_AFFECT_SHIFT;
+	unsigned int spawn = feat & PSYS_SPAWN_MASK;
+
+	advance(dt);
+
+	float age, age_step;
+	if(compact) {
+		(this->*update_compact_kernels[aff])(dt);
+		int count = spawn_count(feat, dt, &age, &age_step);
+		(this->*spawn_compact_kernels[spawn])(count, age, age_step);
+		publish_compact_stats();
+	} else {
+		(this->*update_kernels[aff])(dt);
+		int count = spawn_count(feat, dt, &age, &age_step);
+		(this->*spawn_kernels[spawn])(count, age, age_step);
+
+		if(pp.density_strength > 0.0) {
+			interact(dt);
+		}
 	}
 
-	if(active) {
-		active_time += dt;
+	/* once the particles of the last explosion are gone, the population is at
+	 * a low point, until the new ones spawned in their place grow back
+	 */
+	if(trim_time > 0.0f) {
+		trim_time -= dt;
+		if(trim_time <= 0.0f) {
+			trim_time = 0.0f;
+			trim();
+		}
+	}
+}
+
+/* the ramps or the particle size might have changed since the last update,
+ * so the culling area is worked out again, and the fade out point if the
+ * ramps it depends on did change
+ */
+void ParticleSystem::update_culling()
+{
+	if(!fade_valid || !same_fade(pp, fade_pp)) {
+		fade_cut = fade_cutoff(pp);
+		fade_pp = pp;
+		fade_valid = true;
 	}
 
-	if(expl) {
-		expl = false;
-		//active = false;
+	float max_scale = std::max(pp.pscale_start, std::max(pp.pscale_mid, pp.pscale_end));
+	float margin = (pp.size + fabs(pp.size_range) * 0.5f) * max_scale * 0.5f;
+	if(margin < 0.0f) margin = 0.0f;
+
+	cull_min = Vec3(view_min.x - margin, view_min.y - margin, 0);
+	cull_max = Vec3(view_max.x + margin, view_max.y + margin, 0);
+}
+
+/* push apart crowded particles. It depends on where the other particles
+ * are, so unlike the affectors it can't be applied to one particle at a
+ * time: it takes a pass of its own, through a grid of the current particle
+ * positions, after the update.
+ */
+void ParticleSystem::interact(float dt)
+{
+	if(pp.density_radius <= 0.0) return;
 
-		Vec3 cent = expl_cent + pos;
+	grid.build(plist, PSYS_MAX_CELLS, pcount, pp.density_radius);
 
-		Particle *p = plist;
+	float rad = pp.density_radius;
+	float rad_sq = rad * rad;
+	float s = pp.density_strength * dt;
+
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		Particle *p = plist[i];
 		while(p) {
-			p->max_life = expl_dur;
-			Vec3 dir = p->pos - cent;
-			p->vel += (normalize(dir + Vec3((frand() - 0.5) * 0.5, frand() - 0.5, (frand() - 0.5) * 0.5))) * expl_force;
+			float push_x = 0.0f, push_y = 0.0f;
+
+			grid.query(p->pos, rad, [&](Particle *q) {
+				float dx = p->pos.x - q->pos.x;
+				float dy = p->pos.y - q->pos.y;
+				float dsq = dx * dx + dy * dy;
+				if(dsq >= rad_sq || dsq < 1e-12) return;	// also skips p itself
+
+				float dist = sqrt(dsq);
+				float w = (1.0 - dist / rad) / dist;
+				push_x += dx * w;
+				push_y += dy * w;
+			});
+
+			p->vel.x += push_x * s;
+			p->vel.y += push_y * s;
 			p = p->next;
 		}
 	}
+}
+
+// the ramps at t, outside of an update
+static inline void eval_ramp(const PSysParam &pp, float t, Vec3 *color, float *alpha, float *scale)
+{
+	AffectState s;
+	s.t = t;
+
+	AffColorRamp ramp;
+	ramp.setup(pp);
+	ramp.apply(&s);
+	AffSizeCurve curve;
+	curve.setup(pp);
+	curve.apply(&s);
+
+	*color = s.color;
+	*alpha = s.alpha;
+	*scale = s.scale;
+}
+
+/* fraction of the lifetime from which on the ramps keep the contribution of
+ * a particle (its alpha times its brightest color component, or nothing at
+ * a zero scale) below pp.cull_contrib. It's checked at FADE_STEPS points,
+ * and rounded up to the next one, so it's 1 if particles never fade out.
+ */
+static float fade_cutoff(const PSysParam &pp)
+{
+	if(pp.cull_contrib <= 0.0f) return 1.0f;
+
+	for(int i=FADE_STEPS; i>=0; i--) {
+		Vec3 color;
+		float alpha, scale;
+		eval_ramp(pp, (float)i / FADE_STEPS, &color, &alpha, &scale);
+
+		float c = alpha * std::max(color.x, std::max(color.y, color.z));
+		if(scale > 0.0f && c >= pp.cull_contrib) {
+			return i < FADE_STEPS ? (float)(i + 1) / FADE_STEPS : 1.0f;
+		}
+	}
+	return 0.0f;
+}
+
+// true if fade_cutoff gives the same for both
+static bool same_fade(const PSysParam &a, const PSysParam &b)
+{
+	return a.cull_contrib == b.cull_contrib &&
+		a.pcolor_start == b.pcolor_start && a.pcolor_mid == b.pcolor_mid &&
+		a.pcolor_end == b.pcolor_end && a.palpha_start == b.palpha_start &&
+		a.palpha_mid == b.palpha_mid && a.palpha_end == b.palpha_end &&
+		a.pscale_start == b.pscale_start && a.pscale_mid == b.pscale_mid &&
+		a.pscale_end == b.pscale_end;
+}
+
+// nearest fixed point value, clamped to the range of a short
+static inline short quantize(float x)
+{
+	if(x >= 32767.0f) return 32767;
+	if(x <= -32767.0f) return -32767;
+	return (short)(x >= 0.0f ? x + 0.5f : x - 0.5f);
+}
+
+// index of x in num_steps + 1 steps over base +/- range/2
+static inline int quantize_range(float x, float base, float range, int num_steps)
+{
+	if(range == 0.0f) return 0;
+
+	int idx = (int)((x - (base - range * 0.5f)) / range * num_steps + 0.5f);
+	return idx < 0 ? 0 : (idx > num_steps ? num_steps : idx);
+}
+
+void ParticleSystem::advance(float dt)
+{
+	if(active) {
+		active_time += dt;
+	}
 
 	if(expl_life > 0.0) {
 		expl_life -= dt;
@@ -141,70 +647,321 @@ void ParticleSystem::update(float dt)
 			active = false;
 		}
 	}
+}
 
-	// update active particles
-	Particle *p = plist;
-	while(p) {
-		p->life += dt;
-		if(p->life < p->max_life) {
-			float t = p->life / p->max_life;
+/* number of particles to spawn this frame, and how long ago within it the
+ * first one was due, and each next one after it (a negative step). Spawning
+ * them with those ages, instead of all at the end of the frame, keeps the
+ * flames from coming out in bands at low frame rates.
+ */
+int ParticleSystem::spawn_count(unsigned int feat, float dt, float *first_age, float *age_step)
+{
+	*first_age = *age_step = 0.0f;
 
-			p->pos = p->pos + p->vel * dt;
-			p->vel = p->vel + pp.gravity * dt;
+	bool can_spawn = !(feat & (PSYS_SPAWNMAP | PSYS_SPAWNMESH)) || (spawnmap && !spawnmap->empty());
+	if(!active || !can_spawn) return 0;
 
-			if(t < 0.5) {
-				t *= 2.0;
-				p->color = lerp(pp.pcolor_start, pp.pcolor_mid, t);
-				p->alpha = lerp(pp.palpha_start, pp.palpha_mid, t);
-				p->scale = lerp(pp.pscale_start, pp.pscale_mid, t);
-			} else {
-				t = (t - 0.5) * 2.0;
-				p->color = lerp(pp.pcolor_mid, pp.pcolor_end, t);
-				p->alpha = lerp(pp.palpha_mid, pp.palpha_end, t);
-				p->scale = lerp(pp.pscale_mid, pp.pscale_end, t);
-			}
+	float spawn_rate = pp.spawn_rate;
+	if((feat & PSYS_SPAWNMAP) && pp.spawn_map_speed > 0.0) {
+		float s = active_time * pp.spawn_map_speed;
+		if(s > 1.0) s = 1.0;
+		spawn_rate *= s;
+	}
 
-		} else {
-			p->life = -1.0;
+	float prev_pending = spawn_pending;
+	spawn_pending += spawn_rate * dt;
+	int count = (int)spawn_pending;
+	spawn_pending -= count;
+
+	// the n-th one was due when the accumulator reached n
+	if(count > 0 && spawn_rate > 0.0f) {
+		*first_age = dt - (1.0f - prev_pending) / spawn_rate;
+		*age_step = -1.0f / spawn_rate;
+	}
+	return count;
+}
+
+/* the update passes and the spawn loops are instantiated for every
+ * combination of their features, so that none of the feature tests are left
+ * in the inner loops. Each update pass applies the affectors of its features
+ * to every particle in one go.
+ */
+template <unsigned int FEAT>
+void ParticleSystem::update_kernel(float dt)
+{
+	// only the cells with a pending explosion are visited
+	if(expl_cells) {
+		for(int i=0; i<PSYS_MAX_CELLS; i++) {
+			if(!(expl_cells & (1 << i))) continue;
+
+			const PSysExplosion &ex = expl[i];
+			Vec3 cent = explosion_center(i) + pos;
+
+			Particle *p = plist[i];
+			while(p) {
+				p->max_life = ex.dur;
+				Vec3 dir = p->pos - cent;
+				p->vel += (normalize(dir + Vec3((frand(&rng_state) - 0.5) * 0.5, frand(&rng_state) - 0.5,
+						(frand(&rng_state) - 0.5) * 0.5))) * ex.force;
+				p = p->next;
+			}
 		}
-		p = p->next;
+		expl_cells = 0;
 	}
 
-	// remove dead particles
-	Particle dummy;
-	dummy.next = plist;
-	p = &dummy;
-	while(p->next) {
-		if(p->next->life < 0.0) {
-			Particle *tmp = p->next;
-			p->next = tmp->next;
-			pfree(tmp);
-			--pcount;
-		} else {
+	AffectPipeline<FEAT, true> aff;
+	aff.setup(pp, cull_min, cull_max, pointer, full_units, dt);
+	unsigned long faded = 0;
+
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		// update active particles
+		Particle *p = plist[i];
+		while(p) {
+			p->life += dt;
+			if(p->life < p->max_life * fade_cut) {
+				AffectState s;
+				s.pos = p->pos + p->vel * dt;
+				s.vel = p->vel;
+				s.t = p->life / p->max_life;
+
+				if(aff.apply(&s)) {
+					p->pos = s.pos;
+					p->vel = s.vel;
+					p->color = s.color;
+					p->alpha = s.alpha;
+					p->scale = s.scale;
+				} else {
+					p->life = -1.0;
+				}
+
+			} else {
+				if(p->life < p->max_life) faded++;
+				p->life = -1.0;
+			}
 			p = p->next;
 		}
+
+		// remove dead particles
+		Particle dummy;
+		dummy.next = plist[i];
+		p = &dummy;
+		while(p->next) {
+			if(p->next->life < 0.0) {
+				Particle *tmp = p->next;
+				p->next = tmp->next;
+				pcache.free(tmp);
+				--pcount;
+			} else {
+				p = p->next;
+			}
+		}
+		plist[i] = dummy.next;
 	}
-	plist = dummy.next;
+	num_faded += faded;
+	num_offview += aff.cull.count;
+}
 
-	float spawn_rate = pp.spawn_rate;
-	if(pp.spawn_map && pp.spawn_map_speed > 0.0) {
-		float s = active_time * pp.spawn_map_speed;
-		if(s > 1.0) s = 1.0;
-		spawn_rate *= s;
+/* same as update_kernel, on compact particles. They're kept in an array, and
+ * dead ones are replaced by the last one, so the order isn't preserved.
+ */
+template <unsigned int FEAT>
+void ParticleSystem::update_compact(float dt)
+{
+	float lifetime[256];
+	compact_lifetimes(lifetime);
+
+	if(expl_cells) {
+		for(int c=0; c<PSYS_MAX_CELLS; c++) {
+			if(!(expl_cells & (1 << c))) continue;
+
+			const PSysExplosion &ex = expl[c];
+			Vec3 cent = explosion_center(c) + pos;
+			lifetime[CPART_LIFE_EXPL] = cexpl_dur[c];
+
+			std::vector<CompactParticle> &parts = cparts[c];
+			for(size_t i=0; i<parts.size(); i++) {
+				CompactParticle *p = &parts[i];
+
+				// keep the age in seconds, as a fraction of the new lifetime
+				float age = ex.dur > 0.0f ? p->age / 65536.0f * lifetime[p->life_idx] / ex.dur : 1.0f;
+				p->age = age < 1.0f ? (unsigned short)(age * 65536.0f) : 65535;
+				p->life_idx = CPART_LIFE_EXPL;
+
+				Vec3 ppos = Vec3(p->pos[0], p->pos[1], p->pos[2]) * (1.0f / CPART_POS_SCALE);
+				Vec3 dir = ppos - cent;
+				Vec3 dv = (normalize(dir + Vec3((frand(&rng_state) - 0.5) * 0.5, frand(&rng_state) - 0.5,
+						(frand(&rng_state) - 0.5) * 0.5))) * (ex.force * CPART_VEL_SCALE);
+				p->vel[0] = quantize(p->vel[0] + dv.x);
+				p->vel[1] = quantize(p->vel[1] + dv.y);
+				p->vel[2] = quantize(p->vel[2] + dv.z);
+			}
+			cexpl_dur[c] = ex.dur;
+		}
+		expl_cells = 0;
 	}
 
-	// spawn particles as needed
-	if(active) {
-		spawn_pending += spawn_rate * dt;
+	// age increment per frame for each quantized lifetime
+	unsigned int age_inc[256];
+	for(int i=0; i<256; i++) {
+		age_inc[i] = lifetime[i] > 0.0f ? (unsigned int)(dt / lifetime[i] * 65536.0f) : 65536;
+	}
 
-		while(spawn_pending >= 1.0f) {
-			spawn_pending -= 1.0f;
-			spawn_particle();
+	// ages past the fade out point, in fixed point
+	unsigned int fade_age = fade_cut < 1.0f ? (unsigned int)(fade_cut * 65536.0f) : 65535;
+	unsigned long faded = 0;
+
+	AffectPipeline<FEAT, false> aff;
+	aff.setup(pp, cull_min, cull_max, pointer, compact_units, dt);
+	float pos_step = dt * CPART_POS_SCALE / CPART_VEL_SCALE;
+
+	for(int c=0; c<PSYS_MAX_CELLS; c++) {
+		std::vector<CompactParticle> &parts = cparts[c];
+		if(parts.empty()) continue;
+
+		// only the exploded particles' lifetime differs between cells
+		float expl_dur = cexpl_dur[c];
+		age_inc[CPART_LIFE_EXPL] = expl_dur > 0.0f ? (unsigned int)(dt / expl_dur * 65536.0f) : 65536;
+
+		size_t i = 0;
+		while(i < parts.size()) {
+			CompactParticle *p = &parts[i];
+
+			unsigned int age = p->age + age_inc[p->life_idx];
+			AffectState s;
+			s.vel = Vec3(p->vel[0], p->vel[1], p->vel[2]);
+			s.pos.x = p->pos[0] + s.vel.x * pos_step;
+			s.pos.y = p->pos[1] + s.vel.y * pos_step;
+			s.pos.z = p->pos[2] + s.vel.z * pos_step;
+			s.t = age / 65536.0f;
+
+			bool dead = age > fade_age;
+			if(dead) {
+				if(age <= 65535) faded++;
+			} else {
+				dead = !aff.apply(&s);
+			}
+			if(dead) {
+				*p = parts.back();
+				parts.pop_back();
+				--pcount;
+				++cnum_free;
+				continue;
+			}
+			p->age = age;
+			p->pos[0] = quantize(s.pos.x);
+			p->pos[1] = quantize(s.pos.y);
+			p->pos[2] = quantize(s.pos.z);
+			p->vel[0] = quantize(s.vel.x);
+			p->vel[1] = quantize(s.vel.y);
+			p->vel[2] = quantize(s.vel.z);
+			i++;
 		}
 	}
+	num_faded += faded;
+	num_offview += aff.cull.count;
+}
+
+void ParticleSystem::update_batch(ParticleSystem *const *psys, int count, float dt)
+{
+	get_thread_pool()->parallel_for(count, [=](int i) { psys[i]->update(dt); });
 }
 
 void ParticleSystem::draw() const
+{
+	const ParticleSystem *self = this;
+	draw_batch(&self, 1);
+}
+
+void ParticleSystem::draw_batch(const ParticleSystem *const *psys, int count)
+{
+	if(count <= 0) return;
+	Image *pimg = psys[0]->pp.pimg;
+
+	int cur_sdr = begin_draw(pimg);
+	if(pimg) {
+		draw_quads<true>(psys, count);
+	} else {
+		draw_quads<false>(psys, count);
+	}
+	end_draw(cur_sdr);
+}
+
+bool ParticleSystem::get_bounds(Vec3 *bmin, Vec3 *bmax) const
+{
+	if(!pcount) return false;
+
+	*bmin = Vec3(1e30, 1e30, 1e30);
+	*bmax = Vec3(-1e30, -1e30, -1e30);
+
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		if(compact) {
+			const std::vector<CompactParticle> &parts = cparts[i];
+			for(size_t j=0; j<parts.size(); j++) {
+				PSysVertex v;
+				compact_vertex(&parts[j], &v);
+				vertex_bounds(v.pos, v.hsz, bmin, bmax);
+			}
+			continue;
+		}
+
+		Particle *p = plist[i];
+		while(p) {
+			vertex_bounds(p->pos, p->size * p->scale * 0.5, bmin, bmax);
+			p = p->next;
+		}
+	}
+	return true;
+}
+
+void ParticleSystem::snapshot(std::vector<PSysVertex> *verts) const
+{
+	size_t idx = verts->size();
+	verts->resize(idx + pcount);
+	PSysVertex *v = verts->data() + idx;	// may be empty
+
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		if(compact) {
+			const std::vector<CompactParticle> &parts = cparts[i];
+			for(size_t j=0; j<parts.size(); j++) {
+				compact_vertex(&parts[j], v++);
+			}
+			continue;
+		}
+
+		Particle *p = plist[i];
+		while(p) {
+			v->pos = p->pos;
+			v->hsz = p->size * p->scale * 0.5;
+			v->color = p->color;
+			v->alpha = p->alpha;
+			v++;
+			p = p->next;
+		}
+	}
+}
+
+void ParticleSystem::draw_snapshot(const PSysVertex *verts, int count) const
+{
+	if(count <= 0) return;
+
+	int cur_sdr = begin_draw(pp.pimg);
+
+	glBegin(GL_QUADS);
+	for(int i=0; i<count; i++) {
+		const PSysVertex *v = verts + i;
+		glColor4f(v->color.x, v->color.y, v->color.z, v->alpha);
+		glTexCoord2f(0, 0); glVertex3f(v->pos.x - v->hsz, v->pos.y - v->hsz, v->pos.z);
+		glTexCoord2f(1, 0); glVertex3f(v->pos.x + v->hsz, v->pos.y - v->hsz, v->pos.z);
+		glTexCoord2f(1, 1); glVertex3f(v->pos.x + v->hsz, v->pos.y + v->hsz, v->pos.z);
+		glTexCoord2f(0, 1); glVertex3f(v->pos.x - v->hsz, v->pos.y + v->hsz, v->pos.z);
+	}
+	glEnd();
+
+	end_draw(cur_sdr);
+}
+
+// set up the render state for drawing particles, returns the previous shader
+static int begin_draw(Image *pimg)
 {
 	int cur_sdr = 0;
 	glGetIntegerv(GL_CURRENT_PROGRAM, &cur_sdr);
@@ -217,27 +974,18 @@ void ParticleSystem::draw() const
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 
-	if(pp.pimg) {
-		if(!pp.pimg->texture) {
-			pp.pimg->gen_texture();
+	if(pimg) {
+		if(!pimg->texture) {
+			pimg->gen_texture();
 		}
 		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, pp.pimg->texture);
+		glBindTexture(GL_TEXTURE_2D, pimg->texture);
 	}
+	return cur_sdr;
+}
 
-	glBegin(GL_QUADS);
-	Particle *p = plist;
-	while(p) {
-		float hsz = p->size * p->scale * 0.5;
-		glColor4f(p->color.x, p->color.y, p->color.z, p->alpha);
-		glTexCoord2f(0, 0); glVertex3f(p->pos.x - hsz, p->pos.y - hsz, p->pos.z);
-		glTexCoord2f(1, 0); glVertex3f(p->pos.x + hsz, p->pos.y - hsz, p->pos.z);
-		glTexCoord2f(1, 1); glVertex3f(p->pos.x + hsz, p->pos.y + hsz, p->pos.z);
-		glTexCoord2f(0, 1); glVertex3f(p->pos.x - hsz, p->pos.y + hsz, p->pos.z);
-		p = p->next;
-	}
-	glEnd();
-
+static void end_draw(int cur_sdr)
+{
 	glPopAttrib();
 
 	if(cur_sdr) {
@@ -245,151 +993,298 @@ void ParticleSystem::draw() const
 	}
 }
 
-void ParticleSystem::gen_spawnmap(int count)
+template <bool TEX>
+void ParticleSystem::draw_quads(const ParticleSystem *const *psys, int count)
 {
-	Image *img = pp.spawn_map;
-	if(!img) return;
-
-	delete [] smcache;
-	smcache = new Vec3[count];
-
-	float umax = (float)img->width;
-	float vmax = (float)img->height;
-	float aspect = umax / vmax;
-
-	// first generate a bunch of random samples by rejection sampling
+	glBegin(GL_QUADS);
 	for(int i=0; i<count; i++) {
-		float u, v;
-		unsigned char val, ord;
-
-		do {
-			u = (double)rand() / (double)RAND_MAX;
-			v = (double)rand() / (double)RAND_MAX;
-
-			int x = (int)(u * umax);
-			int y = (int)(v * vmax);
-
-			unsigned char *pptr = img->pixels + (y * img->width + x) * (img->bpp / 8);
-			val = pptr[0];
-			ord = pptr[1];
-		} while(val < 192);
-
-		smcache[i] = Vec3(u * 2.0 - 1.0, (1.0 - v * 2.0) / aspect, ord / 255.0);
-	}
-
-	// then order by z
-	std::sort(smcache, smcache + count,
-			[](const Vec3 &a, const Vec3 &b) { return a.z < b.z; });
-
-	// precalculate the bounds of each slot
-	smcache_max[0] = 0;
-	for(int i=1; i<255; i++) {
-		float maxval = (float)i / 255.0;
+		for(int c=0; c<PSYS_MAX_CELLS; c++) {
+			if(psys[i]->compact) {
+				const std::vector<CompactParticle> &parts = psys[i]->cparts[c];
+				for(size_t j=0; j<parts.size(); j++) {
+					PSysVertex v;
+					psys[i]->compact_vertex(&parts[j], &v);
+
+					glColor4f(v.color.x, v.color.y, v.color.z, v.alpha);
+					if(TEX) glTexCoord2f(0, 0);
+					glVertex3f(v.pos.x - v.hsz, v.pos.y - v.hsz, v.pos.z);
+					if(TEX) glTexCoord2f(1, 0);
+					glVertex3f(v.pos.x + v.hsz, v.pos.y - v.hsz, v.pos.z);
+					if(TEX) glTexCoord2f(1, 1);
+					glVertex3f(v.pos.x + v.hsz, v.pos.y + v.hsz, v.pos.z);
+					if(TEX) glTexCoord2f(0, 1);
+					glVertex3f(v.pos.x - v.hsz, v.pos.y + v.hsz, v.pos.z);
+				}
+				continue;
+			}
 
-		int idx = smcache_max[i - 1];
-		while(++idx < count && smcache[idx].z < maxval);
-		smcache_max[i] = idx;
+			Particle *p = psys[i]->plist[c];
+			while(p) {
+				float hsz = p->size * p->scale * 0.5;
+				glColor4f(p->color.x, p->color.y, p->color.z, p->alpha);
+				if(TEX) glTexCoord2f(0, 0);
+				glVertex3f(p->pos.x - hsz, p->pos.y - hsz, p->pos.z);
+				if(TEX) glTexCoord2f(1, 0);
+				glVertex3f(p->pos.x + hsz, p->pos.y - hsz, p->pos.z);
+				if(TEX) glTexCoord2f(1, 1);
+				glVertex3f(p->pos.x + hsz, p->pos.y + hsz, p->pos.z);
+				if(TEX) glTexCoord2f(0, 1);
+				glVertex3f(p->pos.x - hsz, p->pos.y + hsz, p->pos.z);
+				p = p->next;
+			}
+		}
 	}
-	smcache_max[255] = count;
+	glEnd();
 }
 
-static double frand()
+// x +/- range/2, from random number r
+static inline float jitter(unsigned int r, float x, float range)
 {
-	return (double)rand() / (double)RAND_MAX;
+	return x + (r / 4294967296.0 * range - range * 0.5);
 }
 
-static float rndval(float x, float range)
+// grow a bounding box to include a particle quad (x/y only)
+static inline void vertex_bounds(const Vec3 &pos, float hsz, Vec3 *bmin, Vec3 *bmax)
 {
-	if(fabs(range) < 1e-6) {
-		return x;
-	}
-	return x + (frand() * range - range * 0.5);
+	if(pos.x - hsz < bmin->x) bmin->x = pos.x - hsz;
+	if(pos.x + hsz > bmax->x) bmax->x = pos.x + hsz;
+	if(pos.y - hsz < bmin->y) bmin->y = pos.y - hsz;
+	if(pos.y + hsz > bmax->y) bmax->y = pos.y + hsz;
 }
 
-void ParticleSystem::spawn_particle()
+/* position, lifetime and size of count (up to PSYS_SPAWN_BATCH) new
+ * particles. The random numbers of the whole batch are drawn first, in the
+ * same order as spawning one particle at a time would, then each attribute
+ * is computed for all of them in its own loop.
+ */
+template <unsigned int FEAT>
+void ParticleSystem::spawn_attr(int count, PSysSpawnBatch *b)
 {
-	Particle *p = palloc();
-	p->pos = Vec3(rndval(pos.x, pp.spawn_range),
-			rndval(pos.y, pp.spawn_range),
-			rndval(pos.z, pp.spawn_range));
-	p->vel = Vec3(0, 0, 0);
-	p->color = pp.pcolor_start;
-	p->alpha = pp.palpha_start;
-	p->life = 0.0;
-	p->max_life = rndval(pp.life, pp.life_range);
-	p->size = rndval(pp.size, pp.size_range);
-	p->scale = pp.pscale_start;
+	const int nrnd = ((FEAT & PSYS_JITTER) ? SPAWN_JITTER_RND : 0) +
+		((FEAT & PSYS_SPAWNMESH) ? SPAWNMAP_MESH_RND : ((FEAT & PSYS_SPAWNMAP) ? 1 : 0));
+	const int map_rnd = (FEAT & PSYS_JITTER) ? SPAWN_JITTER_RND : 0;
 
-	if(pp.spawn_map) {
+	unsigned int state = rng_state;
+	for(int i=0; i<count * nrnd; i++) {
+		b->rnd[i] = rng_next(&state);
+	}
+	rng_state = state;
+
+	if(FEAT & PSYS_JITTER) {
+		// z first, the order they were always drawn in, for traces to replay the same
+		const unsigned int *r = b->rnd;
+		for(int i=0; i<count; i++) {
+			b->x[i] = jitter(r[2], pos.x, pp.spawn_range);
+			b->y[i] = jitter(r[1], pos.y, pp.spawn_range);
+			b->z[i] = jitter(r[0], pos.z, pp.spawn_range);
+			b->life[i] = jitter(r[3], pp.life, pp.life_range);
+			b->size[i] = jitter(r[4], pp.size, pp.size_range);
+			r += nrnd;
+		}
+	} else {
+		for(int i=0; i<count; i++) {
+			b->x[i] = pos.x;
+			b->y[i] = pos.y;
+			b->z[i] = pos.z;
+			b->life[i] = pp.life;
+			b->size[i] = pp.size;
+		}
+	}
+
+	const float scale = pp.spawn_map_scale;
+
+	if(FEAT & PSYS_SPAWNMESH) {
+		// meshes have no spawn order, spawn_map_speed only ramps up the rate
+		const unsigned int *r = b->rnd + map_rnd;
+		for(int i=0; i<count; i++) {
+			Vec3 sp = spawnmap->mesh_point(r);
+			b->x[i] += sp.x * scale;
+			b->y[i] += sp.y * scale;
+			b->cell[i] = spawnmap->cell_at(sp.x);
+			r += nrnd;
+		}
+
+	} else if(FEAT & PSYS_SPAWNMAP) {
 		float maxz = pp.spawn_map_speed > 0.0 ? active_time * pp.spawn_map_speed : 1.0;
 		int max_idx = (int)(maxz * 255.0);
 		if(max_idx > 255) max_idx = 255;
 		if(max_idx < 1) max_idx = 1;
-
-		int idx = rand() % smcache_max[max_idx];
-
-		p->pos.x += smcache[idx].x;
-		p->pos.y += smcache[idx].y;
+		unsigned int num = spawnmap->zslot_end[max_idx];
+
+		const unsigned int *r = b->rnd + map_rnd;
+		for(int i=0; i<count; i++) {
+			const Vec3 &sp = spawnmap->samples[*r % num];
+			b->x[i] += sp.x * scale;
+			b->y[i] += sp.y * scale;
+			b->cell[i] = spawnmap->cell_at(sp.x);
+			r += nrnd;
+		}
+	} else {
+		for(int i=0; i<count; i++) {
+			b->cell[i] = 0;
+		}
 	}
 
-	p->next = plist;
-	plist = p;
-	++pcount;
+	if(FEAT & (PSYS_SPAWNMAP | PSYS_SPAWNMESH)) {
+		for(int i=0; i<count; i++) {
+			if(b->cell[i] >= PSYS_MAX_CELLS) {
+				b->cell[i] = PSYS_MAX_CELLS - 1;
+			}
+		}
+	}
 }
 
-// particle allocator
-#define MAX_POOL_SIZE	8192
-static Particle *ppool;
-static int ppool_size;
-
-static Particle *palloc()
+/* spawn count particles, a batch at a time: the particles of each batch are
+ * reserved from the arena in one go, then filled in. The first one is age
+ * seconds old, and each next one age_step older, as if it had been spawned
+ * at that point of the frame and fallen under gravity since.
+ */
+template <unsigned int FEAT>
+void ParticleSystem::spawn_n(int count, float age, float age_step)
 {
-	if(ppool) {
-		Particle *p = ppool;
-		ppool = ppool->next;
-		--ppool_size;
-		return p;
+	PSysSpawnBatch b;
+
+	while(count > 0) {
+		int n = count < PSYS_SPAWN_BATCH ? count : PSYS_SPAWN_BATCH;
+		spawn_attr<FEAT>(n, &b);
+
+		pcache.reserve(n);
+		for(int i=0; i<n; i++) {
+			float t = age > 0.0f ? age : 0.0f;
+			age += age_step;
+
+			Particle *p = pcache.alloc();
+			p->pos = Vec3(b.x[i], b.y[i], b.z[i]) + pp.gravity * (0.5f * t * t);
+			p->vel = pp.gravity * t;
+			p->life = t;
+			p->max_life = b.life[i];
+			p->size = b.size[i];
+			eval_ramp(pp, p->max_life > 0.0f ? t / p->max_life : 1.0f, &p->color, &p->alpha, &p->scale);
+
+			p->next = plist[b.cell[i]];
+			plist[b.cell[i]] = p;
+		}
+		pcount += n;
+		count -= n;
 	}
-	return new Particle;
 }
 
-static void pfree(Particle *p)
+/* compact particles are appended to the arrays of their cells, which are
+ * grown once per batch. Their ages work like in spawn_n.
+ */
+template <unsigned int FEAT>
+void ParticleSystem::spawn_compact_n(int count, float age, float age_step)
 {
-	if(!p) return;
+	PSysSpawnBatch b;
+	float life_min = pp.life - pp.life_range * 0.5f;
 
-	if(ppool_size < MAX_POOL_SIZE) {
-		p->next = ppool;
-		ppool = p;
-		++ppool_size;
-	} else {
-		delete p;
+	while(count > 0) {
+		int n = count < PSYS_SPAWN_BATCH ? count : PSYS_SPAWN_BATCH;
+		spawn_attr<FEAT>(n, &b);
+
+		int cell_count[PSYS_MAX_CELLS] = {0};
+		for(int i=0; i<n; i++) {
+			cell_count[b.cell[i]]++;
+		}
+		CompactParticle *dest[PSYS_MAX_CELLS];
+		for(int i=0; i<PSYS_MAX_CELLS; i++) {
+			if(!cell_count[i]) continue;
+			size_t start = cparts[i].size();
+			cparts[i].resize(start + cell_count[i]);
+			dest[i] = &cparts[i][start];
+		}
+
+		for(int i=0; i<n; i++) {
+			float t = age > 0.0f ? age : 0.0f;
+			age += age_step;
+
+			CompactParticle *p = dest[b.cell[i]]++;
+			p->life_idx = quantize_range(b.life[i], pp.life, pp.life_range, CPART_LIFE_EXPL - 1);
+			p->size_idx = quantize_range(b.size[i], pp.size, pp.size_range, 255);
+
+			// same as compact_lifetimes
+			float lifetime = life_min + pp.life_range * p->life_idx / (CPART_LIFE_EXPL - 1);
+			float frac = lifetime > 0.0f ? t / lifetime : 1.0f;
+			p->age = frac < 1.0f ? (unsigned short)(frac * 65536.0f) : 65535;
+
+			Vec3 fall = pp.gravity * (0.5f * t * t);
+			Vec3 vel = pp.gravity * (t * CPART_VEL_SCALE);
+			p->pos[0] = quantize((b.x[i] + fall.x) * CPART_POS_SCALE);
+			p->pos[1] = quantize((b.y[i] + fall.y) * CPART_POS_SCALE);
+			p->pos[2] = quantize((b.z[i] + fall.z) * CPART_POS_SCALE);
+			p->vel[0] = quantize(vel.x);
+			p->vel[1] = quantize(vel.y);
+			p->vel[2] = quantize(vel.z);
+		}
+
+		cnum_alloc += n;
+		pcount += n;
+		count -= n;
+	}
+	if(pcount > chigh_water) {
+		chigh_water = pcount;
 	}
 }
 
-static void pfreelist(Particle *p)
+// copy the compact mode counts for get_stats, from the thread which updates
+void ParticleSystem::publish_compact_stats()
 {
-	if(!p) return;
+	PArenaStats st;
+	st.live = pcount;
+	st.high_water = chigh_water;
+	st.capacity = st.num_chunks = 0;
+	for(int i=0; i<PSYS_MAX_CELLS; i++) {
+		st.capacity += cparts[i].capacity();
+		if(cparts[i].capacity() > 0) st.num_chunks++;
+	}
+	st.num_alloc = cnum_alloc;
+	st.num_free = cnum_free;
 
-	Particle *it = p;
-	int new_pool_size = ppool_size;
+	std::lock_guard<std::mutex> guard(cstats_lock);
+	cstats = st;
+}
 
-	while(it->next && new_pool_size < MAX_POOL_SIZE) {
-		it = it->next;
-		++new_pool_size;
+/* lifetimes of the quantized life_idx values, except for CPART_LIFE_EXPL,
+ * which depends on the cell
+ */
+void ParticleSystem::compact_lifetimes(float *tab) const
+{
+	float life_min = pp.life - pp.life_range * 0.5f;
+	for(int i=0; i<CPART_LIFE_EXPL; i++) {
+		tab[i] = life_min + pp.life_range * i / (CPART_LIFE_EXPL - 1);
 	}
+	tab[CPART_LIFE_EXPL] = 0.0f;
+}
 
-	Particle *last = it;
-	it = it->next;
-
-	// add the first lot to the pool
-	last->next = ppool;
-	ppool = p;
-	ppool_size = new_pool_size;
+void ParticleSystem::compact_vertex(const CompactParticle *cp, PSysVertex *v) const
+{
+	float size = pp.size - pp.size_range * 0.5f + pp.size_range * cp->size_idx / 255.0f;
+	float scale;
 
-	// delete the rest;
-	while(it) {
-		p = it;
-		it = it->next;
-		delete p;
-	}
+	v->pos = Vec3(cp->pos[0], cp->pos[1], cp->pos[2]) * (1.0f / CPART_POS_SCALE);
+	eval_ramp(pp, cp->age / 65536.0f, &v->color, &v->alpha, &scale);
+	v->hsz = size * scale * 0.5f;
 }
+
+// kernels for features x to x+3, shifted up by sh
+#define KERNELS4(k, x, sh)	\
+	&ParticleSystem::k<(x) << (sh)>, &ParticleSystem::k<(x + 1) << (sh)>, \
+	&ParticleSystem::k<(x + 2) << (sh)>, &ParticleSystem::k<(x + 3) << (sh)>
+
+void (ParticleSystem::*const ParticleSystem::update_kernels[])(float) = {
+	KERNELS4(update_kernel, 0, PSYS_AFFECT_SHIFT), KERNELS4(update_kernel, 4, PSYS_AFFECT_SHIFT),
+	KERNELS4(update_kernel, 8, PSYS_AFFECT_SHIFT), KERNELS4(update_kernel, 12, PSYS_AFFECT_SHIFT)
+};
+
+void (ParticleSystem::*const ParticleSystem::update_compact_kernels[])(float) = {
+	KERNELS4(update_compact, 0, PSYS_AFFECT_SHIFT), KERNELS4(update_compact, 4, PSYS_AFFECT_SHIFT),
+	KERNELS4(update_compact, 8, PSYS_AFFECT_SHIFT), KERNELS4(update_compact, 12, PSYS_AFFECT_SHIFT)
+};
+
+void (ParticleSystem::*const ParticleSystem::spawn_kernels[])(int, float, float) = {
+	KERNELS4(spawn_n, 0, 0), KERNELS4(spawn_n, 4, 0)
+};
+
+void (ParticleSystem::*const ParticleSystem::spawn_compact_kernels[])(int, float, float) = {
+	KERNELS4(spawn_compact_n, 0, 0), KERNELS4(spawn_compact_n, 4, 0)
+};
@@ -19,8 +19,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define PSYS_H_
 
 #include <vector>
+#include <atomic>
+#include <mutex>
 #include "vec3.h"
 #include "image.h"
+#include "parena.h"
+#include "spawnmap.h"
+#include "noise.h"
+#include "sgrid.h"
 
 struct PSysParam {
 	// emitter parameters
@@ -29,18 +35,69 @@ struct PSysParam {
 	float life, life_range;
 	float size, size_range;
 	Vec3 gravity;
+	float drag;				// velocity lost per second, exponentially (0: none)
 	Image *spawn_map;
 	float spawn_map_speed;
+	float spawn_map_scale;	// size of the spawn map area (default: 1)
+
+	// turbulence: acceleration from a curl noise field (null: none)
+	const NoiseVolume *turb;
+	float turb_strength;
+	float turb_freq;		// noise features per unit
+
+	// push apart crowded particles (strength 0: off)
+	float density_strength;
+	float density_radius;
 
 	// particle parameters
 	Image *pimg;
 	Vec3 pcolor_start, pcolor_mid, pcolor_end;
 	float palpha_start, palpha_mid, palpha_end;
 	float pscale_start, pscale_mid, pscale_end;
+
+	/* particles are retired as soon as the ramps keep their alpha times their
+	 * brightest color component below this (0: never, default: half an 8-bit
+	 * step, which is lost to rounding)
+	 */
+	float cull_contrib;
+
+	/* frame feedback trails, applied when drawing: the previous frame fades to
+	 * half its brightness in trail_halflife seconds (0: no trails), and moves
+	 * along with trail_drift, in units per second
+	 */
+	float trail_halflife;
+	Vec3 trail_drift;
 };
 
 void psys_default(PSysParam *pp);
 
+/* features which select the specialized update/draw code. The spawn and
+ * the affector features are independent of each other, and select their
+ * kernels separately.
+ */
+enum {
+	// spawning
+	PSYS_SPAWNMAP	= 1,	// spawn positions from a spawn map
+	PSYS_SPAWNMESH	= 2,	// spawn map is a triangle mesh
+	PSYS_JITTER		= 4,	// random ranges for spawn position, life or size
+
+	// affectors (see affect.h)
+	PSYS_GRAVITY	= 8,	// non-zero gravity
+	PSYS_TURB		= 16,	// turbulence field
+	PSYS_DRAG		= 32,	// velocity damping
+	PSYS_POINTER	= 64,	// pointer interaction
+
+	PSYS_TEXTURED	= 128	// textured sprites (draw only)
+};
+#define PSYS_SPAWN_MASK		7
+#define PSYS_AFFECT_SHIFT	3
+#define PSYS_AFFECT_MASK	(15 << PSYS_AFFECT_SHIFT)
+
+/* particles are partitioned by the character cell of the spawn map which
+ * spawned them, so that a single character can be acted upon on its own
+ */
+#define PSYS_MAX_CELLS		8
+
 struct Particle {
 	Vec3 pos, vel;
 	Vec3 color;
@@ -51,23 +108,115 @@ struct Particle {
 	struct Particle *next;
 };
 
+/* particle of the compact mode: fixed point position and velocity, and
+ * quantized age, lifetime and size, in 16 bytes. Color, alpha and scale
+ * are derived from the age when they're needed.
+ */
+struct CompactParticle {
+	short pos[3];			// CPART_POS_SCALE units per unit
+	short vel[3];			// CPART_VEL_SCALE units per unit/sec
+	unsigned short age;		// fraction of the lifetime, in 1/65536ths
+	unsigned char life_idx;	// lifetime, quantized over the life range
+	unsigned char size_idx;	// size, quantized over the size range
+};
+
+#define CPART_POS_SCALE		8192.0f	// range: +/- 4
+#define CPART_VEL_SCALE		2048.0f	// range: +/- 16
+#define CPART_LIFE_EXPL		255		// life_idx of particles caught in an explosion
+
+static_assert(sizeof(CompactParticle) == 16, "CompactParticle should be 16 bytes");
+
+// pointer interaction, in the same space as the particles
+struct PSysPointer {
+	Vec3 pos, vel;
+	float radius;
+	float repel;	// push particles away from the pointer
+	float stir;		// drag particles along with the pointer
+};
+
+// everything needed to draw a particle, for drawing outside of the simulation
+struct PSysVertex {
+	Vec3 pos;
+	float hsz;		// half size
+	Vec3 color;
+	float alpha;
+};
+
+struct PSysSpawnBatch;
+
+struct PSysExplosion {
+	Vec3 cent;
+	bool centroid;		// around the center of the cell's particles, instead of cent
+	float force, dur;
+};
+
 class ParticleSystem {
 private:
 	float spawn_pending;
-	Particle *plist;
-	int pcount;
+	Particle *plist[PSYS_MAX_CELLS];
+	int pcount;			// of all cells
+
+	unsigned int rng_state;
 
 	float active_time;
-	bool expl;
-	Vec3 expl_cent;
-	float expl_force, expl_dur;
+	unsigned int expl_cells;	// cells with an explosion pending
+	PSysExplosion expl[PSYS_MAX_CELLS];
 	float expl_life;
+	float trim_time;	// until the last explosion has retired its particles
+
+	ParticleArena arena;
+	ParticleCache pcache;
+
+	// compact mode particles, instead of plist
+	bool compact;
+	std::vector<CompactParticle> cparts[PSYS_MAX_CELLS];
+	float cexpl_dur[PSYS_MAX_CELLS];	// lifetime of the exploded particles of each cell
+	int chigh_water;
+	unsigned long cnum_alloc, cnum_free;
+	// copy of the above for get_stats, which may be called during an update
+	PArenaStats cstats;
+	mutable std::mutex cstats_lock;
+
+	SpawnMap *spawnmap;
+	std::atomic<SpawnMap*> new_spawnmap;	// set_spawnmap hands it over to update
+
+	SpatialGrid grid;
+	PSysPointer pointer;
+	bool pointer_active;
+
+	float fade_cut;				// fraction of the lifetime they're retired at
+	PSysParam fade_pp;			// the ramps and cull_contrib fade_cut is for
+	bool fade_valid;
+	Vec3 view_min, view_max;	// x/y area particles are visible in
+	Vec3 cull_min, cull_max;	// the view area, grown by the largest particle size
+	std::atomic<unsigned long> num_faded, num_offview;
+
+	unsigned int features() const;
+	void switch_spawnmap();
+	void update_culling();
+	void advance(float dt);
+	int spawn_count(unsigned int feat, float dt, float *first_age, float *age_step);
+	void interact(float dt);
+	void clear_particles();
+	Vec3 explosion_center(int cell) const;
 
-	Vec3 *smcache;
-	int smcache_max[256];
-	void gen_spawnmap(int count);
+	template <unsigned int FEAT> void spawn_attr(int count, PSysSpawnBatch *b);
+	template <unsigned int FEAT> void update_kernel(float dt);
+	template <unsigned int FEAT> void spawn_n(int count, float age, float age_step);
+	template <unsigned int FEAT> void update_compact(float dt);
+	template <unsigned int FEAT> void spawn_compact_n(int count, float age, float age_step);
+	template <bool TEX> static void draw_quads(const ParticleSystem *const *psys, int count);
 
-	void spawn_particle();
+	void compact_lifetimes(float *tab) const;
+	void publish_compact_stats();
+	void compact_vertex(const CompactParticle *cp, PSysVertex *v) const;
+
+	// by affector features, shifted down
+	static void (ParticleSystem::*const update_kernels[(PSYS_AFFECT_MASK >> PSYS_AFFECT_SHIFT) + 1])(float);
+	static void (ParticleSystem::*const update_compact_kernels[(PSYS_AFFECT_MASK >> PSYS_AFFECT_SHIFT) + 1])(float);
+	// by spawn features
+	static void (ParticleSystem::*const spawn_kernels[PSYS_SPAWN_MASK + 1])(int, float, float);
+	static void (ParticleSystem::*const spawn_compact_kernels[PSYS_SPAWN_MASK + 1])(int, float, float);
 
 public:
 	Vec3 pos;
@@ -78,14 +227,74 @@ public:
 	~ParticleSystem();
 
 	void reset();
+
+	/* keep particles in the compact form (4 times smaller, but no density
+	 * interaction). Switching drops all current particles.
+	 */
+	void set_compact(bool c);
+	bool is_compact() const;
+	// rebuild the spawn map from pp.spawn_map on the next update
 	void reset_spawnmap();
+	/* switch to a spawn map built elsewhere (takes ownership). Can be called
+	 * from any thread, the switch happens at the start of the next update.
+	 */
+	void set_spawnmap(SpawnMap *sm);
+
+	// each system has its own random number generator, to update in parallel
+	void seed(unsigned int s);
+
+	// pre-allocate space for count particles
+	void reserve(int count);
+	// give back memory not needed for the current particle population
+	void trim();
+	void get_stats(PArenaStats *st);
 
 	void explode(const Vec3 &c, float force, float dur = 1.0, float life = 0.0);
+	/* explode only the particles of one character cell, from the center of
+	 * their current positions, in time proportional to their number. With a
+	 * low force, it's a way to retire them quickly.
+	 */
+	void explode_cell(int cell, float force, float dur = 1.0);
+
+	// pointer to react to from the next update on, null for none
+	void set_pointer(const PSysPointer *ptr);
+	/* area of the x/y plane which is drawn (default: everything). Particles
+	 * which leave it are dropped, even if they might have drifted back in.
+	 */
+	void set_view(const Vec3 &vmin, const Vec3 &vmax);
+
+	// particles retired early, because they had faded out or left the view
+	void get_cull_stats(unsigned long *faded, unsigned long *offview) const;
 
 	bool alive() const;
 
+	/* serialized simulation state: the particles, the spawn accumulator, the
+	 * active time and the random number generator. Explosions in progress,
+	 * the spawn map and the parameters aren't part of it. The layout is
+	 * native, it's meant to be read back by the same build.
+	 */
+	size_t state_size() const;
+	void save_state(void *buf) const;
+	// false if the data is malformed, or from the other particle mode
+	bool load_state(const void *buf, size_t size);
+
 	void update(float dt);
 	void draw() const;
+
+	// update a number of systems in parallel on the global thread pool
+	static void update_batch(ParticleSystem *const *psys, int count, float dt);
+	/* draw the particles of a number of systems in a single batch, with the
+	 * render state (particle texture) of the first one.
+	 */
+	static void draw_batch(const ParticleSystem *const *psys, int count);
+
+	// bounding box of the drawn particles, false if there are none
+	bool get_bounds(Vec3 *bmin, Vec3 *bmax) const;
+
+	// append the current state of all particles to verts
+	void snapshot(std::vector<PSysVertex> *verts) const;
+	// draw a snapshot, with the render state of this system
+	void draw_snapshot(const PSysVertex *verts, int count) const;
 };
 
 #endif	// PSYS_H_
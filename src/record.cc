@@ -0,0 +1,294 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "opengl.h"
+#include "record.h"
+#include "imgenc.h"
+
+/* frames are read back into a ring of pixel buffer objects, and each PBO is
+ * only mapped REC_NUM_PBO-1 frames later, by which time the transfer is long
+ * done, so glReadPixels never stalls waiting for rendering to finish.
+ */
+#define REC_NUM_PBO		3
+// RGBA frames waiting for the conversion thread, we drop frames beyond that
+#define REC_NUM_FRAMES	4
+
+struct RecFrame {
+	int width, height;	// actual size of the captured area (<= rec_width/height)
+	std::vector<unsigned char> pixels;
+};
+
+static void rec_thread_func();
+static void write_y4m_frame(RecFrame *frm);
+static void flush_pbo(int idx);
+
+static FILE *rec_fp;
+static int rec_fps;
+static int rec_width, rec_height;
+
+static unsigned int pbo[REC_NUM_PBO];
+static int pbo_width[REC_NUM_PBO], pbo_height[REC_NUM_PBO];
+static bool pbo_full[REC_NUM_PBO];
+static int pbo_cur;
+
+static RecFrame frames[REC_NUM_FRAMES];
+static std::deque<RecFrame*> free_frames, ready_frames;
+static std::mutex frames_lock;
+static std::condition_variable frames_cond;
+static std::thread rec_thread;
+static bool rec_quit;
+
+static long num_captured, num_dropped;
+
+// conversion buffers, only touched by the conversion thread
+static std::vector<unsigned char> yuv_buf, rgb_row[2];
+
+bool rec_open(const char *fname, int fps)
+{
+	if(strcmp(fname, "-") == 0) {
+		int fd = dup(1);
+		if(fd == -1 || !(rec_fp = fdopen(fd, "wb"))) {
+			perror("failed to open stdout for recording");
+			return false;
+		}
+		dup2(2, 1);
+	} else {
+		if(!(rec_fp = fopen(fname, "wb"))) {
+			fprintf(stderr, "failed to open recording output: %s\n", fname);
+			return false;
+		}
+	}
+	rec_fps = fps > 0 ? fps : 60;
+	return true;
+}
+
+bool rec_active()
+{
+	return rec_fp != 0;
+}
+
+void rec_frame(int width, int height)
+{
+	if(!rec_fp) return;
+
+	if(!pbo[0]) {
+		// 4:2:0 chroma subsampling needs even dimensions
+		rec_width = width & ~1;
+		rec_height = height & ~1;
+		if(rec_width <= 0 || rec_height <= 0) return;
+
+		fprintf(rec_fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", rec_width,
+				rec_height, rec_fps);
+
+		glGenBuffers(REC_NUM_PBO, pbo);
+		for(int i=0; i<REC_NUM_PBO; i++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, rec_width * rec_height * 4, 0, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		for(int i=0; i<REC_NUM_FRAMES; i++) {
+			frames[i].pixels.resize(rec_width * rec_height * 4);
+			free_frames.push_back(frames + i);
+		}
+		rec_quit = false;
+		rec_thread = std::thread(rec_thread_func);
+	}
+
+	// the oldest PBO in the ring has had a couple of frames to complete
+	if(pbo_full[pbo_cur]) {
+		flush_pbo(pbo_cur);
+	}
+
+	// the stream size is fixed, so if the window grew capture the part that fits
+	int xsz = width < rec_width ? width : rec_width;
+	int ysz = height < rec_height ? height : rec_height;
+
+	glPixelStorei(GL_PACK_ROW_LENGTH, rec_width);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[pbo_cur]);
+	glReadPixels(0, 0, xsz, ysz, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+
+	pbo_width[pbo_cur] = xsz;
+	pbo_height[pbo_cur] = ysz;
+	pbo_full[pbo_cur] = true;
+	pbo_cur = (pbo_cur + 1) % REC_NUM_PBO;
+}
+
+void rec_close()
+{
+	if(!rec_fp) return;
+
+	if(pbo[0]) {
+		// drain the PBO ring, oldest first
+		for(int i=0; i<REC_NUM_PBO; i++) {
+			int idx = (pbo_cur + i) % REC_NUM_PBO;
+			if(pbo_full[idx]) {
+				flush_pbo(idx);
+			}
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(frames_lock);
+			rec_quit = true;
+		}
+		frames_cond.notify_all();
+		rec_thread.join();
+
+		glDeleteBuffers(REC_NUM_PBO, pbo);
+		memset(pbo, 0, sizeof pbo);
+	}
+
+	fclose(rec_fp);
+	rec_fp = 0;
+
+	fprintf(stderr, "recording: %ld frames captured, %ld dropped\n", num_captured, num_dropped);
+}
+
+static void flush_pbo(int idx)
+{
+	pbo_full[idx] = false;
+
+	RecFrame *frm = 0;
+	{
+		std::unique_lock<std::mutex> lock(frames_lock);
+		if(!free_frames.empty()) {
+			frm = free_frames.front();
+			free_frames.pop_front();
+		}
+	}
+	if(!frm) {
+		// the conversion thread can't keep up (or the pipe is full), drop it
+		++num_dropped;
+		return;
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[idx]);
+	void *src = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if(src) {
+		memcpy(&frm->pixels[0], src, rec_width * rec_height * 4);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	std::unique_lock<std::mutex> lock(frames_lock);
+	if(src) {
+		frm->width = pbo_width[idx];
+		frm->height = pbo_height[idx];
+		ready_frames.push_back(frm);
+		frames_cond.notify_all();
+		++num_captured;
+	} else {
+		free_frames.push_back(frm);
+		++num_dropped;
+	}
+}
+
+static void rec_thread_func()
+{
+	std::unique_lock<std::mutex> lock(frames_lock);
+
+	for(;;) {
+		while(ready_frames.empty() && !rec_quit) {
+			frames_cond.wait(lock);
+		}
+		if(ready_frames.empty()) break;
+
+		RecFrame *frm = ready_frames.front();
+		ready_frames.pop_front();
+
+		lock.unlock();
+		write_y4m_frame(frm);
+		lock.lock();
+
+		free_frames.push_back(frm);
+	}
+}
+
+// BT.601 studio range
+#define RGB_TO_Y(r, g, b)	((( 66 * (r) + 129 * (g) +  25 * (b) + 128) >> 8) + 16)
+#define RGB_TO_U(r, g, b)	(((-38 * (r) -  74 * (g) + 112 * (b) + 128) >> 8) + 128)
+#define RGB_TO_V(r, g, b)	(((112 * (r) -  94 * (g) -  18 * (b) + 128) >> 8) + 128)
+
+static void write_y4m_frame(RecFrame *frm)
+{
+	int ysize = rec_width * rec_height;
+	int csize = ysize / 4;
+	int cwidth = rec_width / 2;
+
+	// the frame header and all three planes go out in a single write
+	static const char hdr[] = "FRAME\n";
+	yuv_buf.resize(sizeof hdr - 1 + ysize + csize * 2);
+	memcpy(&yuv_buf[0], hdr, sizeof hdr - 1);
+
+	unsigned char *yplane = &yuv_buf[sizeof hdr - 1];
+	unsigned char *uplane = yplane + ysize;
+	unsigned char *vplane = uplane + csize;
+
+	for(int i=0; i<2; i++) {
+		rgb_row[i].resize(rec_width * 4);
+	}
+
+	// process pairs of scanlines, the image is bottom-up
+	for(int i=0; i<rec_height; i += 2) {
+		for(int j=0; j<2; j++) {
+			int y = rec_height - 1 - (i + j);
+			unsigned char *dest = &rgb_row[j][0];
+
+			if(y < frm->height) {
+				const unsigned char *src = &frm->pixels[y * rec_width * 4];
+				// our window is transparent, composite over black
+				img_premultiply(dest, src, frm->width);
+				memset(dest + frm->width * 4, 0, (rec_width - frm->width) * 4);
+			} else {
+				memset(dest, 0, rec_width * 4);
+			}
+
+			unsigned char *ydest = yplane + (i + j) * rec_width;
+			for(int k=0; k<rec_width; k++) {
+				*ydest++ = RGB_TO_Y(dest[0], dest[1], dest[2]);
+				dest += 4;
+			}
+		}
+
+		const unsigned char *row0 = &rgb_row[0][0];
+		const unsigned char *row1 = &rgb_row[1][0];
+		unsigned char *udest = uplane + (i / 2) * cwidth;
+		unsigned char *vdest = vplane + (i / 2) * cwidth;
+
+		for(int k=0; k<cwidth; k++) {
+			int r = (row0[0] + row0[4] + row1[0] + row1[4] + 2) >> 2;
+			int g = (row0[1] + row0[5] + row1[1] + row1[5] + 2) >> 2;
+			int b = (row0[2] + row0[6] + row1[2] + row1[6] + 2) >> 2;
+			*udest++ = RGB_TO_U(r, g, b);
+			*vdest++ = RGB_TO_V(r, g, b);
+			row0 += 8;
+			row1 += 8;
+		}
+	}
+
+	fwrite(&yuv_buf[0], 1, yuv_buf.size(), rec_fp);
+}
@@ -0,0 +1,37 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RECORD_H_
+#define RECORD_H_
+
+/* live recording of the presented frames to a YUV4MPEG2 stream.
+ * fname "-" means stdout, in which case stdout is redirected to stderr, to
+ * keep any informational messages out of the video stream. Call rec_open
+ * before anything gets printed.
+ */
+bool rec_open(const char *fname, int fps);
+bool rec_active();
+
+/* capture the current frame of the given size. Must be called with the
+ * OpenGL context current, after rendering and before swapping buffers.
+ */
+void rec_frame(int width, int height);
+
+// flush any in-flight frames and close the stream (needs the GL context)
+void rec_close();
+
+#endif	// RECORD_H_
@@ -0,0 +1,40 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RNG_H_
+#define RNG_H_
+
+/* xorshift32 pseudo-random number generator. Cheap, and with the state
+ * kept by the caller, so each particle system (or worker) has its own
+ * independent and repeatable sequence. The state must never be 0.
+ */
+inline unsigned int rng_next(unsigned int *state)
+{
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// [0, 1)
+inline double frand(unsigned int *state)
+{
+	return rng_next(state) / 4294967296.0;
+}
+
+#endif	// RNG_H_
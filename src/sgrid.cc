@@ -0,0 +1,96 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "sgrid.h"
+#include "psys.h"
+
+SpatialGrid::SpatialGrid()
+{
+	x0 = y0 = 0.0f;
+	inv_cell = 1.0f;
+	cols = rows = 0;
+}
+
+void SpatialGrid::build(Particle *const *lists, int num_lists, int count, float cell_size)
+{
+	items.clear();
+	cols = rows = 0;
+	if(count <= 0) return;
+
+	// bounds of the particles, and an array of them to make the other passes cheap
+	unsorted.resize(count);
+	Vec3 bmin = Vec3(1e30, 1e30, 0);
+	Vec3 bmax = Vec3(-1e30, -1e30, 0);
+
+	int num = 0;
+	for(int i=0; i<num_lists; i++) {
+		Particle *p = lists[i];
+		while(p && num < count) {
+			unsorted[num++] = p;
+			if(p->pos.x < bmin.x) bmin.x = p->pos.x;
+			if(p->pos.x > bmax.x) bmax.x = p->pos.x;
+			if(p->pos.y < bmin.y) bmin.y = p->pos.y;
+			if(p->pos.y > bmax.y) bmax.y = p->pos.y;
+			p = p->next;
+		}
+	}
+	if(!num) return;
+
+	float xsz = bmax.x - bmin.x;
+	float ysz = bmax.y - bmin.y;
+	float maxsz = xsz > ysz ? xsz : ysz;
+	if(maxsz / cell_size > SGRID_MAX_DIM - 1) {
+		cell_size = maxsz / (SGRID_MAX_DIM - 1);
+	}
+
+	x0 = bmin.x;
+	y0 = bmin.y;
+	inv_cell = 1.0f / cell_size;
+	cols = (int)(xsz * inv_cell) + 1;
+	rows = (int)(ysz * inv_cell) + 1;
+	int num_cells = cols * rows;
+
+	// count the particles in each cell
+	cell_start.assign(num_cells + 1, 0);
+	item_cell.resize(num);
+	for(int i=0; i<num; i++) {
+		int cx = (int)((unsorted[i]->pos.x - x0) * inv_cell);
+		int cy = (int)((unsorted[i]->pos.y - y0) * inv_cell);
+		if(cx >= cols) cx = cols - 1;
+		if(cy >= rows) cy = rows - 1;
+
+		int cidx = cy * cols + cx;
+		item_cell[i] = cidx;
+		cell_start[cidx + 1]++;
+	}
+
+	// turn the counts into the start of each cell
+	for(int i=0; i<num_cells; i++) {
+		cell_start[i + 1] += cell_start[i];
+	}
+
+	// place every particle after the ones before it in the same cell
+	items.resize(num);
+	for(int i=0; i<num; i++) {
+		items[cell_start[item_cell[i]]++] = unsorted[i];
+	}
+	// which moved each start to the end of its cell, shift them back
+	for(int i=num_cells; i>0; i--) {
+		cell_start[i] = cell_start[i - 1];
+	}
+	cell_start[0] = 0;
+}
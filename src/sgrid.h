@@ -0,0 +1,87 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SGRID_H_
+#define SGRID_H_
+
+#include <vector>
+#include "vec3.h"
+
+#define SGRID_MAX_DIM	256
+
+struct Particle;
+
+/* uniform grid over the x/y positions of lists of particles, rebuilt from
+ * scratch every frame with a counting sort: one pass to count the particles
+ * in each cell, a prefix sum for the start of each cell, and one pass to put
+ * every particle in place. Neighborhood queries only visit the cells around
+ * the query point.
+ */
+class SpatialGrid {
+private:
+	float x0, y0, inv_cell;
+	int cols, rows;
+	std::vector<int> cell_start;		// cols * rows + 1 entries
+	std::vector<Particle*> items;		// particles sorted by cell
+	std::vector<Particle*> unsorted;	// scratch space for building
+	std::vector<int> item_cell;
+
+public:
+	SpatialGrid();
+
+	/* count is the total number of particles in all num_lists lists. Cells
+	 * might end up larger than cell_size, to keep the grid size in check.
+	 */
+	void build(Particle *const *lists, int num_lists, int count, float cell_size);
+
+	/* call func(Particle*) for the particles in all cells overlapping the
+	 * square of half-size radius around c. It's up to func to test the
+	 * actual distance.
+	 */
+	template <class F> void query(const Vec3 &c, float radius, F func) const;
+};
+
+template <class F>
+void SpatialGrid::query(const Vec3 &c, float radius, F func) const
+{
+	if(items.empty()) return;
+
+	int xmin = (int)((c.x - radius - x0) * inv_cell);
+	int xmax = (int)((c.x + radius - x0) * inv_cell);
+	int ymin = (int)((c.y - radius - y0) * inv_cell);
+	int ymax = (int)((c.y + radius - y0) * inv_cell);
+
+	// the grid is bounded by the particles, so everything outside is empty
+	if(c.x + radius < x0 || c.y + radius < y0 || xmin >= cols || ymin >= rows) {
+		return;
+	}
+	if(xmin < 0) xmin = 0;
+	if(ymin < 0) ymin = 0;
+	if(xmax >= cols) xmax = cols - 1;
+	if(ymax >= rows) ymax = rows - 1;
+
+	for(int i=ymin; i<=ymax; i++) {
+		const int *cptr = &cell_start[i * cols];
+		for(int j=xmin; j<=xmax; j++) {
+			for(int k=cptr[j]; k<cptr[j + 1]; k++) {
+				func(items[k]);
+			}
+		}
+	}
+}
+
+#endif	// SGRID_H_
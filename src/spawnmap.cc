@@ -0,0 +1,204 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "spawnmap.h"
+
+#define SPAWN_THRES		192
+
+SpawnMap::SpawnMap()
+{
+	samples = 0;
+	num_samples = 0;
+	memset(zslot_end, 0, sizeof zslot_end);
+	num_tris = 0;
+}
+
+SpawnMap::~SpawnMap()
+{
+	delete [] samples;
+}
+
+bool SpawnMap::build(const Image *img, int count, unsigned int seed)
+{
+	delete [] samples;
+	samples = 0;
+	num_samples = 0;
+	memset(zslot_end, 0, sizeof zslot_end);
+	tri_verts.clear();
+	tri_prob.clear();
+	tri_alias.clear();
+	num_tris = 0;
+
+	if(!img || !img->pixels) return false;
+
+	int pixsz = img->bpp / 8;
+	int npix = img->width * img->height;
+
+	// rejection sampling would never terminate on an empty image
+	const unsigned char *pptr = img->pixels;
+	bool empty = true;
+	for(int i=0; i<npix; i++) {
+		if(pptr[0] >= SPAWN_THRES) {
+			empty = false;
+			break;
+		}
+		pptr += pixsz;
+	}
+	if(empty) return false;
+
+	samples = new Vec3[count];
+	num_samples = count;
+
+	unsigned int rng = seed ? seed : 1;
+
+	float umax = (float)img->width;
+	float vmax = (float)img->height;
+	float aspect = umax / vmax;
+
+	// first generate a bunch of random samples by rejection sampling
+	for(int i=0; i<count; i++) {
+		float u, v;
+		unsigned char val, ord;
+
+		do {
+			u = frand(&rng);
+			v = frand(&rng);
+
+			int x = (int)(u * umax);
+			int y = (int)(v * vmax);
+
+			pptr = img->pixels + (y * img->width + x) * pixsz;
+			val = pptr[0];
+			ord = pptr[1];
+		} while(val < SPAWN_THRES);
+
+		samples[i] = Vec3(u * 2.0 - 1.0, (1.0 - v * 2.0) / aspect, ord / 255.0);
+	}
+
+	// then order by z
+	std::sort(samples, samples + count,
+			[](const Vec3 &a, const Vec3 &b) { return a.z < b.z; });
+
+	// precalculate the bounds of each slot
+	zslot_end[0] = 0;
+	for(int i=1; i<255; i++) {
+		float maxval = (float)i / 255.0;
+
+		int idx = zslot_end[i - 1];
+		while(++idx < count && samples[idx].z < maxval);
+		zslot_end[i] = idx;
+	}
+	zslot_end[255] = count;
+	return true;
+}
+
+bool SpawnMap::build(const Vec3 *tris, int count, int width, int height)
+{
+	tri_verts.clear();
+	tri_prob.clear();
+	tri_alias.clear();
+	num_tris = 0;
+	delete [] samples;
+	samples = 0;
+	num_samples = 0;
+	memset(zslot_end, 0, sizeof zslot_end);
+
+	if(count <= 0) return false;
+
+	// same mapping from pixels to spawn positions as for images
+	float sx = 2.0 / width;
+	float sy = 2.0 / height;
+	float aspect = (float)width / (float)height;
+
+	tri_verts.resize(count * 3);
+	std::vector<float> area(count);
+	double total_area = 0.0;
+
+	for(int i=0; i<count * 3; i++) {
+		tri_verts[i] = Vec3(tris[i].x * sx - 1.0, (1.0 - tris[i].y * sy) / aspect, 1.0);
+	}
+	for(int i=0; i<count; i++) {
+		const Vec3 *v = &tri_verts[i * 3];
+		area[i] = fabs((v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y));
+		total_area += area[i];
+	}
+	if(total_area <= 0.0) {
+		tri_verts.clear();
+		return false;
+	}
+
+	/* Vose's alias method: each slot keeps its own triangle with probability
+	 * prob, and otherwise falls through to its alias, so picking a triangle
+	 * by area takes one random slot and one comparison.
+	 */
+	tri_prob.resize(count);
+	tri_alias.resize(count);
+
+	std::vector<int> small, large;
+	for(int i=0; i<count; i++) {
+		area[i] = area[i] * count / total_area;
+		if(area[i] < 1.0f) {
+			small.push_back(i);
+		} else {
+			large.push_back(i);
+		}
+	}
+
+	while(!small.empty() && !large.empty()) {
+		int s = small.back();
+		int l = large.back();
+		small.pop_back();
+
+		tri_prob[s] = area[s];
+		tri_alias[s] = l;
+
+		area[l] = area[l] + area[s] - 1.0f;
+		if(area[l] < 1.0f) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// whatever is left is 1 within rounding error
+	for(size_t i=0; i<large.size(); i++) {
+		tri_prob[large[i]] = 1.0f;
+		tri_alias[large[i]] = large[i];
+	}
+	for(size_t i=0; i<small.size(); i++) {
+		tri_prob[small[i]] = 1.0f;
+		tri_alias[small[i]] = small[i];
+	}
+
+	num_tris = count;
+	return true;
+}
+
+bool SpawnMap::empty() const
+{
+	return num_samples <= 0 && num_tris <= 0;
+}
+
+void SpawnMap::set_cells(const float *xend, int count, int width)
+{
+	// same mapping as for the spawn positions
+	cell_end.resize(count);
+	for(int i=0; i<count; i++) {
+		cell_end[i] = xend[i] * 2.0 / width - 1.0;
+	}
+}
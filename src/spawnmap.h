@@ -0,0 +1,115 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPAWNMAP_H_
+#define SPAWNMAP_H_
+
+#include <vector>
+#include "vec3.h"
+#include "image.h"
+#include "rng.h"
+
+#define SPAWNMAP_DEF_SAMPLES	2048
+
+/* spawn positions for a particle system, either a set of random positions
+ * sampled from the bright pixels of an image, ordered by the order value
+ * stored in the green channel, or a triangle mesh covering the spawn area,
+ * sampled directly as particles are spawned. Building one doesn't touch any
+ * shared state, so it can be done on any thread.
+ */
+class SpawnMap {
+public:
+	Vec3 *samples;		// x/y: position, z: order in [0, 1]
+	int num_samples;
+	int zslot_end[256];	// end of the samples with order below each of 256 slots
+
+	// triangle mesh (3 vertices per triangle) with an alias table by area
+	std::vector<Vec3> tri_verts;
+	std::vector<float> tri_prob;
+	std::vector<int> tri_alias;
+	int num_tris;
+
+	/* right edge of each character cell, in spawn map coordinates, for
+	 * partitioning particles by character. Empty for a single cell.
+	 */
+	std::vector<float> cell_end;
+
+	SpawnMap();
+	~SpawnMap();
+
+	SpawnMap(const SpawnMap&) = delete;
+	SpawnMap &operator =(const SpawnMap&) = delete;
+
+	// returns false, leaving the map empty, if the image has no bright pixels
+	bool build(const Image *img, int count, unsigned int seed);
+	/* build from triangles in the pixel coordinates of a width x height
+	 * spawn map image. Returns false if they have no area.
+	 */
+	bool build(const Vec3 *tris, int count, int width, int height);
+
+	bool empty() const;
+
+	// set the cells from their right edges in pixels, in an image of width pixels
+	void set_cells(const float *xend, int count, int width);
+	// character cell containing spawn map x coordinate x
+	inline int cell_at(float x) const;
+
+	// uniformly distributed random position in the triangle mesh
+	inline Vec3 sample_mesh(unsigned int *rng) const;
+	// same, from SPAWNMAP_MESH_RND random numbers drawn in advance
+	inline Vec3 mesh_point(const unsigned int *rnd) const;
+};
+
+#define SPAWNMAP_MESH_RND	4
+
+inline Vec3 SpawnMap::sample_mesh(unsigned int *rng) const
+{
+	unsigned int rnd[SPAWNMAP_MESH_RND];
+	for(int i=0; i<SPAWNMAP_MESH_RND; i++) {
+		rnd[i] = rng_next(rng);
+	}
+	return mesh_point(rnd);
+}
+
+inline Vec3 SpawnMap::mesh_point(const unsigned int *rnd) const
+{
+	int idx = rnd[0] % num_tris;
+	if(rnd[1] / 4294967296.0 >= tri_prob[idx]) {
+		idx = tri_alias[idx];
+	}
+
+	float u = rnd[2] / 4294967296.0;
+	float v = rnd[3] / 4294967296.0;
+	if(u + v > 1.0f) {
+		u = 1.0f - u;
+		v = 1.0f - v;
+	}
+
+	const Vec3 *tri = &tri_verts[idx * 3];
+	return tri[0] + (tri[1] - tri[0]) * u + (tri[2] - tri[0]) * v;
+}
+
+inline int SpawnMap::cell_at(float x) const
+{
+	int count = cell_end.size();
+	for(int i=0; i<count - 1; i++) {
+		if(x < cell_end[i]) return i;
+	}
+	return count > 0 ? count - 1 : 0;
+}
+
+#endif	// SPAWNMAP_H_
@@ -0,0 +1,155 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include "tpool.h"
+
+ThreadPool::ThreadPool(int num_threads)
+{
+	if(num_threads <= 0) {
+		num_threads = std::thread::hardware_concurrency() - 1;
+		if(num_threads < 1) num_threads = 1;
+	}
+
+	num_pending = 0;
+	quit = false;
+
+	for(int i=0; i<num_threads; i++) {
+		workers.push_back(std::thread(&ThreadPool::thread_func, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(jobs_lock);
+		quit = true;
+	}
+	jobs_cond.notify_all();
+
+	for(size_t i=0; i<workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+int ThreadPool::num_threads() const
+{
+	return (int)workers.size();
+}
+
+int ThreadPool::pending()
+{
+	std::unique_lock<std::mutex> lock(jobs_lock);
+	return num_pending;
+}
+
+void ThreadPool::add_job(const std::function<void ()> &job)
+{
+	{
+		std::unique_lock<std::mutex> lock(jobs_lock);
+		jobs.push_back(job);
+		++num_pending;
+	}
+	jobs_cond.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(jobs_lock);
+	while(num_pending > 0) {
+		done_cond.wait(lock);
+	}
+}
+
+struct ParallelFor {
+	std::atomic<int> next, done;
+	std::mutex lock;
+	std::condition_variable cond;
+};
+
+void ThreadPool::parallel_for(int count, const std::function<void (int)> &func)
+{
+	if(count <= 0) return;
+	if(count == 1 || workers.empty()) {
+		for(int i=0; i<count; i++) {
+			func(i);
+		}
+		return;
+	}
+
+	std::shared_ptr<ParallelFor> pf = std::make_shared<ParallelFor>();
+	pf->next = 0;
+	pf->done = 0;
+
+	/* helpers which start late, after all the work is done, just find nothing
+	 * left to do and never touch func, which by then might be gone.
+	 */
+	const std::function<void (int)> *fptr = &func;
+	std::function<void ()> body = [pf, count, fptr]() {
+		int i;
+		while((i = pf->next++) < count) {
+			(*fptr)(i);
+			if(++pf->done == count) {
+				std::unique_lock<std::mutex> lock(pf->lock);
+				pf->cond.notify_all();
+			}
+		}
+	};
+
+	int nhelpers = std::min(count - 1, (int)workers.size());
+	for(int i=0; i<nhelpers; i++) {
+		add_job(body);
+	}
+	body();
+
+	std::unique_lock<std::mutex> lock(pf->lock);
+	while(pf->done < count) {
+		pf->cond.wait(lock);
+	}
+}
+
+void ThreadPool::thread_func()
+{
+	std::unique_lock<std::mutex> lock(jobs_lock);
+
+	for(;;) {
+		while(jobs.empty() && !quit) {
+			jobs_cond.wait(lock);
+		}
+		if(jobs.empty()) break;	// quit, and nothing left to do
+
+		std::function<void ()> job = jobs.front();
+		jobs.pop_front();
+
+		lock.unlock();
+		job();
+		lock.lock();
+
+		if(--num_pending == 0) {
+			done_cond.notify_all();
+		}
+	}
+}
+
+ThreadPool *get_thread_pool()
+{
+	// constructed on first call, thread-safe as of C++11
+	static ThreadPool pool;
+	return &pool;
+}
@@ -0,0 +1,63 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TPOOL_H_
+#define TPOOL_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool {
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void ()>> jobs;
+	std::mutex jobs_lock;
+	std::condition_variable jobs_cond, done_cond;
+	int num_pending;	// queued + currently running
+	bool quit;
+
+	void thread_func();
+
+public:
+	/* num_threads <= 0 means one less than the number of processors, but at
+	 * least one worker.
+	 */
+	explicit ThreadPool(int num_threads = 0);
+	~ThreadPool();
+
+	int num_threads() const;
+	int pending();
+
+	void add_job(const std::function<void ()> &job);
+	// block until all queued jobs have been completed
+	void wait();
+
+	/* call func(i) for every i in [0, count), spread across the workers and
+	 * the calling thread, and return when all of them are done. Doesn't wait
+	 * for any unrelated jobs, and never blocks if all workers are busy.
+	 */
+	void parallel_for(int count, const std::function<void (int)> &func);
+};
+
+// global thread pool, created on first use
+ThreadPool *get_thread_pool();
+
+#endif	// TPOOL_H_
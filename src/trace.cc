@@ -0,0 +1,345 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+/* file layout, all values little-endian:
+ *   magic "ACTRACE1", flags, num_sims, clocks_per_sim, and a seed for each clock
+ *   then records, starting with a type byte:
+ *     frame: dt
+ *     string: clock (16 bits), prebuilt (8 bits), seed, length (8 bits), characters
+ *     turbulence: t
+ *     pointer: simulation (8 bits, signed), pos, vel, radius, repel, stir
+ *     explode: clock (16 bits), center, force, dur, life
+ *     burst: clock (16 bits), cell (8 bits), force, dur
+ *     view: simulation (8 bits), min x, min y, max x, max y
+ * integers are 32 bits and floats are IEEE single precision, unless noted.
+ */
+#define TRACE_MAGIC		"ACTRACE1"
+
+enum { REC_FRAME = 0x46 };	// event records use the TRACE_EV_ values
+
+static void write_u8(unsigned int x);
+static void write_u16(unsigned int x);
+static void write_u32(unsigned int x);
+static void write_float(float x);
+static void write_vec3(const Vec3 &v);
+static bool read_u8(unsigned int *x);
+static bool read_u16(unsigned int *x);
+static bool read_u32(unsigned int *x);
+static bool read_float(float *x);
+static bool read_vec3(Vec3 *v);
+static bool read_event(int type, TraceEvent *ev);
+
+static FILE *fp;
+static bool writing;
+
+bool trace_record(const char *fname, const TraceHeader *hdr)
+{
+	int num_clocks = hdr->num_sims * hdr->clocks_per_sim;
+	if(num_clocks > TRACE_MAX_CLOCKS) {
+		fprintf(stderr, "trace: too many clocks\n");
+		return false;
+	}
+
+	if(!(fp = fopen(fname, "wb"))) {
+		fprintf(stderr, "failed to open trace file for writing: %s\n", fname);
+		return false;
+	}
+	writing = true;
+
+	fwrite(TRACE_MAGIC, 1, 8, fp);
+	write_u32(hdr->flags);
+	write_u32(hdr->num_sims);
+	write_u32(hdr->clocks_per_sim);
+	for(int i=0; i<num_clocks; i++) {
+		write_u32(hdr->seed[i]);
+	}
+	return true;
+}
+
+bool trace_replay(const char *fname, TraceHeader *hdr)
+{
+	if(!(fp = fopen(fname, "rb"))) {
+		fprintf(stderr, "failed to open trace file: %s\n", fname);
+		return false;
+	}
+	writing = false;
+
+	char magic[8];
+	unsigned int num_sims, clocks_per_sim;
+	if(fread(magic, 1, 8, fp) < 8 || memcmp(magic, TRACE_MAGIC, 8) != 0 ||
+			!read_u32(&hdr->flags) || !read_u32(&num_sims) || !read_u32(&clocks_per_sim)) {
+		fprintf(stderr, "%s is not a valid trace file\n", fname);
+		trace_close();
+		return false;
+	}
+	if(num_sims < 1 || clocks_per_sim < 1 || num_sims * clocks_per_sim > TRACE_MAX_CLOCKS) {
+		fprintf(stderr, "%s: invalid number of clocks\n", fname);
+		trace_close();
+		return false;
+	}
+	hdr->num_sims = num_sims;
+	hdr->clocks_per_sim = clocks_per_sim;
+
+	for(unsigned int i=0; i<num_sims * clocks_per_sim; i++) {
+		if(!read_u32(hdr->seed + i)) {
+			fprintf(stderr, "%s: unexpected end of file\n", fname);
+			trace_close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void trace_close()
+{
+	if(fp) {
+		fclose(fp);
+		fp = 0;
+	}
+}
+
+bool trace_recording()
+{
+	return fp && writing;
+}
+
+bool trace_replaying()
+{
+	return fp && !writing;
+}
+
+void trace_write_frame(float dt)
+{
+	if(!trace_recording()) return;
+
+	write_u8(REC_FRAME);
+	write_float(dt);
+}
+
+void trace_write_event(const TraceEvent *ev)
+{
+	if(!trace_recording()) return;
+
+	write_u8(ev->type);
+
+	switch(ev->type) {
+	case TRACE_EV_STRING:
+		{
+			int len = strlen(ev->str);
+			write_u16(ev->clock);
+			write_u8(ev->prebuilt ? 1 : 0);
+			write_u32(ev->seed);
+			write_u8(len);
+			fwrite(ev->str, 1, len, fp);
+		}
+		break;
+
+	case TRACE_EV_TURB:
+		write_float(ev->t);
+		break;
+
+	case TRACE_EV_POINTER:
+		write_u8(ev->clock & 0xff);
+		write_vec3(ev->ptr.pos);
+		write_vec3(ev->ptr.vel);
+		write_float(ev->ptr.radius);
+		write_float(ev->ptr.repel);
+		write_float(ev->ptr.stir);
+		break;
+
+	case TRACE_EV_EXPLODE:
+		write_u16(ev->clock);
+		write_vec3(ev->cent);
+		write_float(ev->force);
+		write_float(ev->dur);
+		write_float(ev->life);
+		break;
+
+	case TRACE_EV_BURST:
+		write_u16(ev->clock);
+		write_u8(ev->cell);
+		write_float(ev->force);
+		write_float(ev->dur);
+		break;
+
+	case TRACE_EV_VIEW:
+		write_u8(ev->clock);
+		write_float(ev->vmin.x);
+		write_float(ev->vmin.y);
+		write_float(ev->vmax.x);
+		write_float(ev->vmax.y);
+		break;
+	}
+}
+
+bool trace_read_frame(TraceFrame *frame)
+{
+	if(!trace_replaying()) return false;
+
+	unsigned int type;
+	if(!read_u8(&type) || type != REC_FRAME || !read_float(&frame->dt)) {
+		return false;
+	}
+
+	frame->events.clear();
+
+	int c;
+	while((c = fgetc(fp)) != EOF) {
+		if(c == REC_FRAME) {
+			ungetc(c, fp);
+			break;
+		}
+
+		TraceEvent ev;
+		if(!read_event(c, &ev)) {
+			fprintf(stderr, "trace: corrupt event record, stopping\n");
+			return false;
+		}
+		frame->events.push_back(ev);
+	}
+	return true;
+}
+
+static bool read_event(int type, TraceEvent *ev)
+{
+	unsigned int x, len;
+
+	*ev = TraceEvent();
+	ev->type = type;
+
+	switch(type) {
+	case TRACE_EV_STRING:
+		if(!read_u16(&x)) return false;
+		ev->clock = x;
+		if(!read_u8(&x)) return false;
+		ev->prebuilt = x != 0;
+		if(!read_u32(&ev->seed) || !read_u8(&len)) return false;
+		if(len >= sizeof ev->str || fread(ev->str, 1, len, fp) < len) {
+			return false;
+		}
+		ev->str[len] = 0;
+		return true;
+
+	case TRACE_EV_TURB:
+		return read_float(&ev->t);
+
+	case TRACE_EV_POINTER:
+		if(!read_u8(&x)) return false;
+		ev->clock = (signed char)x;
+		return read_vec3(&ev->ptr.pos) && read_vec3(&ev->ptr.vel) && read_float(&ev->ptr.radius) &&
+			read_float(&ev->ptr.repel) && read_float(&ev->ptr.stir);
+
+	case TRACE_EV_EXPLODE:
+		if(!read_u16(&x)) return false;
+		ev->clock = x;
+		return read_vec3(&ev->cent) && read_float(&ev->force) && read_float(&ev->dur) &&
+			read_float(&ev->life);
+
+	case TRACE_EV_BURST:
+		if(!read_u16(&x)) return false;
+		ev->clock = x;
+		if(!read_u8(&x)) return false;
+		ev->cell = x;
+		return read_float(&ev->force) && read_float(&ev->dur);
+
+	case TRACE_EV_VIEW:
+		if(!read_u8(&x)) return false;
+		ev->clock = x;
+		return read_float(&ev->vmin.x) && read_float(&ev->vmin.y) &&
+			read_float(&ev->vmax.x) && read_float(&ev->vmax.y);
+
+	default:
+		break;
+	}
+	return false;
+}
+
+static void write_u8(unsigned int x)
+{
+	fputc(x & 0xff, fp);
+}
+
+static void write_u16(unsigned int x)
+{
+	fputc(x & 0xff, fp);
+	fputc((x >> 8) & 0xff, fp);
+}
+
+static void write_u32(unsigned int x)
+{
+	unsigned char buf[4] = {
+		(unsigned char)x, (unsigned char)(x >> 8),
+		(unsigned char)(x >> 16), (unsigned char)(x >> 24)
+	};
+	fwrite(buf, 1, 4, fp);
+}
+
+// floats are written as their bit patterns, to replay them exactly
+static void write_float(float x)
+{
+	unsigned int bits;
+	memcpy(&bits, &x, 4);
+	write_u32(bits);
+}
+
+static void write_vec3(const Vec3 &v)
+{
+	write_float(v.x);
+	write_float(v.y);
+	write_float(v.z);
+}
+
+static bool read_u8(unsigned int *x)
+{
+	int c = fgetc(fp);
+	if(c == EOF) return false;
+	*x = c;
+	return true;
+}
+
+static bool read_u16(unsigned int *x)
+{
+	unsigned char buf[2];
+	if(fread(buf, 1, 2, fp) < 2) return false;
+	*x = buf[0] | (buf[1] << 8);
+	return true;
+}
+
+static bool read_u32(unsigned int *x)
+{
+	unsigned char buf[4];
+	if(fread(buf, 1, 4, fp) < 4) return false;
+	*x = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned int)buf[3] << 24);
+	return true;
+}
+
+static bool read_float(float *x)
+{
+	unsigned int bits;
+	if(!read_u32(&bits)) return false;
+	memcpy(x, &bits, 4);
+	return true;
+}
+
+static bool read_vec3(Vec3 *v)
+{
+	return read_float(&v->x) && read_float(&v->y) && read_float(&v->z);
+}
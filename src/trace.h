@@ -0,0 +1,90 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <vector>
+#include "psys.h"
+
+/* binary trace of everything the simulation depends on: the seeds, the time
+ * step of every frame, the displayed strings, and any other input. Replaying
+ * a trace runs exactly the same simulation, bit for bit, which makes for a
+ * repeatable workload to compare builds with.
+ */
+
+#define TRACE_MAX_CLOCKS	128
+
+// setup flags which change the simulation
+enum {
+	TRACE_RASTER_SPAWN	= 1,
+	TRACE_COMPACT		= 2,
+	TRACE_TURBULENCE	= 4,
+	TRACE_DENSITY		= 8,
+	TRACE_TRAILS		= 16	// halves the spawn rate
+};
+
+struct TraceHeader {
+	unsigned int flags;
+	int num_sims, clocks_per_sim;
+	unsigned int seed[TRACE_MAX_CLOCKS];	// of each clock's particle system
+};
+
+enum {
+	TRACE_EV_STRING,	// the string of a clock changed
+	TRACE_EV_TURB,		// switched to a new turbulence field
+	TRACE_EV_POINTER,	// the pointer changed
+	TRACE_EV_EXPLODE,	// a clock exploded
+	TRACE_EV_BURST,		// a character cell of a clock exploded
+	TRACE_EV_VIEW		// the visible area of a simulation changed
+};
+
+struct TraceEvent {
+	int type;
+	int clock;				// string/explode/burst: clock index, pointer: simulation or -1,
+							// view: simulation
+	int cell;				// burst
+	char str[64];			// string
+	bool prebuilt;			// string: spawn map built in advance, with seed
+	unsigned int seed;
+	float t;				// turbulence: build time
+	PSysPointer ptr;		// pointer
+	Vec3 cent;				// explode
+	float force, dur, life;	// explode, burst: force and dur
+	Vec3 vmin, vmax;		// view: x/y bounds
+};
+
+struct TraceFrame {
+	float dt;
+	std::vector<TraceEvent> events;	// to apply before the update, in order
+};
+
+bool trace_record(const char *fname, const TraceHeader *hdr);
+bool trace_replay(const char *fname, TraceHeader *hdr);
+void trace_close();
+
+bool trace_recording();
+bool trace_replaying();
+
+// recording: start a frame, then add the events which lead up to its update
+void trace_write_frame(float dt);
+void trace_write_event(const TraceEvent *ev);
+
+// replay: returns false at the end of the trace
+bool trace_read_frame(TraceFrame *frame);
+
+#endif	// TRACE_H_
@@ -0,0 +1,183 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include "opengl.h"
+#include "trails.h"
+
+static void draw_quad(float x0, float y0, float x1, float y1);
+
+Trails::Trails()
+{
+	fbo[0] = fbo[1] = 0;
+	tex[0] = tex[1] = 0;
+	cur = 0;
+	width = height = 0;
+	prev_fbo = 0;
+	prev_scissor = false;
+}
+
+Trails::~Trails()
+{
+	destroy();
+}
+
+bool Trails::resize(int xsz, int ysz)
+{
+	if(fbo[0] && xsz == width && ysz == height) {
+		return true;
+	}
+	destroy();
+
+	int bound_fbo;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound_fbo);
+
+	glGenTextures(2, tex);
+	glGenFramebuffers(2, fbo);
+	for(int i=0; i<2; i++) {
+		glBindTexture(GL_TEXTURE_2D, tex[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, xsz, ysz, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex[i], 0);
+		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			fprintf(stderr, "trails: incomplete framebuffer\n");
+			glBindFramebuffer(GL_FRAMEBUFFER, bound_fbo);
+			destroy();
+			return false;
+		}
+
+		// the first frame fades in from nothing
+		glPushAttrib(GL_COLOR_BUFFER_BIT | GL_SCISSOR_BIT);
+		glDisable(GL_SCISSOR_TEST);
+		glClearColor(0, 0, 0, 0);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glPopAttrib();
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, bound_fbo);
+
+	width = xsz;
+	height = ysz;
+	cur = 0;
+	return true;
+}
+
+void Trails::destroy()
+{
+	if(fbo[0]) {
+		glDeleteFramebuffers(2, fbo);
+		fbo[0] = fbo[1] = 0;
+	}
+	if(tex[0]) {
+		glDeleteTextures(2, tex);
+		tex[0] = tex[1] = 0;
+	}
+	width = height = 0;
+}
+
+void Trails::begin(float dx, float dy, float keep)
+{
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+	prev_scissor = glIsEnabled(GL_SCISSOR_TEST);
+
+	// all of it fades and moves, not just the part which is about to be redrawn
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo[cur ^ 1]);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_TEXTURE_BIT | GL_CURRENT_BIT);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glDisable(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, tex[cur]);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	glColor4f(keep, keep, keep, keep);
+
+	float x = dx * 2.0f / width;
+	float y = dy * 2.0f / height;
+	draw_quad(x - 1.0f, y - 1.0f, x + 1.0f, y + 1.0f);
+
+	/* the last 8-bit step doesn't fade, when keep rounds it back up, so take
+	 * it away from everything, to let the trails die out
+	 */
+	glDisable(GL_TEXTURE_2D);
+	glEnable(GL_BLEND);
+	glBlendEquation(GL_FUNC_REVERSE_SUBTRACT);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glColor4f(1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f);
+	draw_quad(-1, -1, 1, 1);
+	glBlendEquation(GL_FUNC_ADD);
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glPopAttrib();
+}
+
+void Trails::end()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+	if(prev_scissor) {
+		glEnable(GL_SCISSOR_TEST);
+	}
+
+	glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_CURRENT_BIT);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	// replaces the contents, like clearing and drawing the frame would
+	glDisable(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, tex[cur ^ 1]);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	draw_quad(-1, -1, 1, 1);
+
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+	glPopAttrib();
+
+	cur ^= 1;
+}
+
+static void draw_quad(float x0, float y0, float x1, float y1)
+{
+	glBegin(GL_QUADS);
+	glTexCoord2f(0, 0); glVertex2f(x0, y0);
+	glTexCoord2f(1, 0); glVertex2f(x1, y0);
+	glTexCoord2f(1, 1); glVertex2f(x1, y1);
+	glTexCoord2f(0, 1); glVertex2f(x0, y1);
+	glEnd();
+}
@@ -0,0 +1,54 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TRAILS_H_
+#define TRAILS_H_
+
+/* frame feedback: every frame is drawn into a texture, on top of the
+ * previous frame, faded and moved along the drift of the flames. Particles
+ * leave trails behind, so fewer of them make up flames of the same density.
+ * The result is then copied to the framebuffer the frame was meant for.
+ */
+class Trails {
+private:
+	unsigned int fbo[2], tex[2];	// the previous frame, and the one being drawn
+	int cur;						// index of the previous frame
+	int width, height;
+
+	int prev_fbo;
+	bool prev_scissor;
+
+public:
+	Trails();
+	~Trails();
+
+	Trails(const Trails&) = delete;
+	Trails &operator =(const Trails&) = delete;
+
+	// (re)create the buffers for a frame size, keeps them if it's the same
+	bool resize(int xsz, int ysz);
+	void destroy();
+
+	/* start a frame: draws the previous one moved by dx/dy pixels, with its
+	 * brightness scaled by keep, and leaves its buffer bound for drawing
+	 */
+	void begin(float dx, float dy, float keep);
+	// copy the finished frame to the framebuffer which was bound before begin
+	void end();
+};
+
+#endif	// TRAILS_H_
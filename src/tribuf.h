@@ -0,0 +1,60 @@
+/*
+alphaclock - transparent desktop clock
+Copyright (C) 2016-2017  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef TRIBUF_H_
+#define TRIBUF_H_
+
+#include <atomic>
+
+/* lock-free single producer/single consumer triple buffer. The producer
+ * fills write_buffer() and calls publish(); the consumer calls acquire() to
+ * get the most recently published buffer. Neither side ever waits for the
+ * other, and published buffers which were never read are simply overwritten.
+ */
+template <class T>
+class TripleBuffer {
+private:
+	enum { FRESH = 4, INDEX_MASK = 3 };
+
+	T buf[3];
+	std::atomic<int> middle;	// index of the spare buffer | FRESH
+	int back;		// owned by the producer
+	int front;		// owned by the consumer
+	bool valid;		// consumer got at least one buffer
+
+public:
+	TripleBuffer() : middle(1), back(0), front(2), valid(false) {}
+
+	T *write_buffer() { return buf + back; }
+
+	void publish()
+	{
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	// returns 0 if nothing has been published yet
+	T *acquire()
+	{
+		if(middle.load(std::memory_order_relaxed) & FRESH) {
+			front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+			valid = true;
+		}
+		return valid ? buf + front : 0;
+	}
+};
+
+#endif	// TRIBUF_H_
@@ -74,6 +74,11 @@ inline Vec3 operator *(float s, const Vec3 &v)
 	return Vec3(v.x * s, v.y * s, v.z * s);
 }
 
+inline bool operator ==(const Vec3 &a, const Vec3 &b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
 inline float dot(const Vec3 &a, const Vec3 &b)
 {
 	return a.x * b.x + a.y * b.y + a.z * b.z;